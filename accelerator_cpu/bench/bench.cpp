@@ -0,0 +1,288 @@
+// bench.cpp
+//
+// Benchmark of the image commands of vector-add-buffers, on its sycl, host
+// and multi engines. The stages, statistics, baselines and options are
+// common/Bench.hpp's.
+//
+// use (from build/, inputs are read from ../in/):
+//   ./bench -i=test3.png --commands=flip,brighten --engines=sycl,host --reps=1,10 --samples=10
+//   ./bench -i=test3.png,noise.png --json=bench.json --csv=bench.csv --label=$(git rev-parse --short HEAD)
+//   ./bench -i=test3.png --commands=flip,blend --samples=20 --profile=devcloud-xeon --save-baseline
+//   ./bench --profile=devcloud-xeon --compare
+//
+
+#include <sycl/sycl.hpp>
+#if FPGA_HARDWARE || FPGA_EMULATOR || FPGA_SIMULATOR
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#endif
+#include <vector>
+#include <string>
+#include <iostream>
+#include <memory>
+#include <filesystem>
+
+#include "PngImage.hpp"
+#include "ImageStages.hpp"
+#include "PixelMath.hpp"
+#include "HostEngine.hpp"
+#include "MultiDevice.hpp"
+#include "Bench.hpp"
+
+using bench::Clock;
+using bench::Ms;
+
+// Create an exception handler for asynchronous SYCL exceptions
+static auto exception_handler = [](sycl::exception_list e_list) {
+    for(std::exception_ptr const & e: e_list) {
+        try {
+            std::rethrow_exception(e);
+        } catch (std::exception const & e) {
+            std::cerr << "Asynchronous SYCL exception: " << e.what() << std::endl;
+            std::terminate();
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Engines
+// Upload() hands the engine the packed inputs and where the result goes,
+// Run() launches the kernel reps times, Download() brings the result back.
+// Engines working in host memory have no transfers to time.
+////////////////////////////////////////////////////////////////////////////////
+
+struct PixelParams {
+    px::Brighten brighten;
+    px::Blend blend;
+};
+
+class Engine : public bench::Engine {
+public:
+    explicit Engine(const PixelParams &params) : m_params(params) {}
+
+    virtual bool transfers(void) const { return false; }
+    virtual void Upload(const std::vector<uint64_t> &a, const std::vector<uint64_t> &a2, std::vector<uint64_t> &out) {
+        m_a = a.data();
+        m_a2 = a2.data();
+        m_out = out.data();
+        m_size = out.size();
+    }
+    virtual void Run(const std::string &command, const PixelParams &params, size_t reps, size_t width, size_t height) = 0;
+    virtual void Download(void) {}
+
+    std::vector<double> Sample(const std::string &command, const std::string &input, const std::string &input2,
+                               size_t reps, size_t &width, size_t &height) override {
+        const std::vector<std::string> &kStages = bench::kStages;
+        std::vector<double> ms(kStages.size(), -1);
+        bool two_inputs = command == "blend" || command == "diff";
+        std::vector<uint64_t> a, a2, out;
+        img::PNG_PIXEL_RGBA_16_ROWS rows, rows2;
+
+        auto t0 = Clock::now();
+        img::PNG png(std::filesystem::path("../in/" + input));
+        rows = png.asRGBA16();
+        if(two_inputs) {
+            img::PNG png2(std::filesystem::path("../in/" + input2));
+            rows2 = png2.asRGBA16();
+            if(rows2.size() != rows.size() || rows2[0].size() != rows[0].size())
+                throw std::runtime_error("'" + input2 + "' is not the size of '" + input + "'");
+        }
+        width = rows[0].size();
+        height = rows.size();
+
+        auto t1 = Clock::now();
+        stage::Flatten(rows, a);
+        if(two_inputs)
+            stage::Flatten(rows2, a2);
+        out.resize(a.size());
+
+        auto t2 = Clock::now();
+        Upload(a, a2, out);
+        auto t3 = Clock::now();
+        Run(command, m_params, reps, width, height);
+        auto t4 = Clock::now();
+        Download();
+
+        auto t5 = Clock::now();
+        stage::Unflatten(out, rows);
+
+        auto t6 = Clock::now();
+        png.fromRGBA16(rows);
+        png.saveToFile(std::filesystem::path("../out/bench.png"));
+        auto t7 = Clock::now();
+
+        ms[0] = Ms(t0, t1);
+        ms[1] = Ms(t1, t2);
+        ms[3] = Ms(t3, t4);
+        if(transfers()) {
+            ms[2] = Ms(t2, t3);
+            ms[4] = Ms(t4, t5);
+        }
+        ms[5] = Ms(t5, t6);
+        ms[6] = Ms(t6, t7);
+        ms[7] = Ms(t0, t7);
+        return ms;
+    }
+
+protected:
+    PixelParams m_params;
+    const uint64_t *m_a = nullptr;
+    const uint64_t *m_a2 = nullptr;
+    uint64_t *m_out = nullptr;
+    size_t m_size = 0;
+};
+
+// The SYCL kernels of vector-add-buffers, on device buffers filled and
+// drained by explicit copies so the transfers can be timed apart
+class SyclEngine : public Engine {
+public:
+    template <typename Selector>
+    SyclEngine(Selector selector, const PixelParams &params) : Engine(params), m_q(selector, exception_handler) {}
+
+    std::string name(void) const override { return "sycl"; }
+    std::string description(void) const override {
+        return m_q.get_device().get_info<sycl::info::device::name>();
+    }
+    bool transfers(void) const override { return true; }
+
+    void Upload(const std::vector<uint64_t> &a, const std::vector<uint64_t> &a2, std::vector<uint64_t> &out) override {
+        Engine::Upload(a, a2, out);
+        m_a_buf.reset(new sycl::buffer<uint64_t, 1>(sycl::range<1>(a.size())));
+        m_a2_buf.reset(new sycl::buffer<uint64_t, 1>(sycl::range<1>(std::max<size_t>(1, a2.size()))));
+        m_out_buf.reset(new sycl::buffer<uint64_t, 1>(sycl::range<1>(out.size())));
+        m_q.submit([&](sycl::handler &h) {
+            sycl::accessor dst(*m_a_buf, h, sycl::write_only, sycl::no_init);
+            h.copy(a.data(), dst);
+        });
+        if(!a2.empty()) {
+            m_q.submit([&](sycl::handler &h) {
+                sycl::accessor dst(*m_a2_buf, h, sycl::write_only, sycl::no_init);
+                h.copy(a2.data(), dst);
+            });
+        }
+        m_q.wait();
+    }
+
+    void Run(const std::string &command, const PixelParams &params, size_t reps, size_t width, size_t height) override {
+        for (size_t repetition = 0; repetition < reps; repetition++) {
+            m_q.submit([&](sycl::handler &h) {
+                sycl::accessor a(*m_a_buf, h, sycl::read_only);
+                sycl::accessor a2(*m_a2_buf, h, sycl::read_only);
+                sycl::accessor b(*m_out_buf, h, sycl::write_only);
+                if(command == "flip") {
+                    h.parallel_for(height, [=](auto i) { stage::FlipRow(a, b, i, width); });
+                } else if(command == "brighten") {
+                    px::Brighten op = params.brighten;
+                    h.parallel_for(height, [=](auto i) { stage::MapRow(a, b, i, width, op); });
+                } else if(command == "blend") {
+                    px::Blend op = params.blend;
+                    h.parallel_for(height, [=](auto i) { stage::MapRow(a, a2, b, i, width, op); });
+                } else if(command == "diff") {
+                    h.parallel_for(height, [=](auto i) { stage::MapRow(a, a2, b, i, width, px::Diff{}); });
+                }
+            });
+        }
+        m_q.wait();
+    }
+
+    void Download(void) override {
+        m_q.submit([&](sycl::handler &h) {
+            sycl::accessor src(*m_out_buf, h, sycl::read_only);
+            h.copy(src, m_out);
+        });
+        m_q.wait();
+    }
+
+private:
+    sycl::queue m_q;
+    std::unique_ptr<sycl::buffer<uint64_t, 1>> m_a_buf, m_a2_buf, m_out_buf;
+};
+
+// The host thread pool engine, same kernels as --engine=host
+class HostEngine : public Engine {
+public:
+    HostEngine(size_t threads, const PixelParams &params) : Engine(params), m_pool(threads) {
+        m_flip_row = host::SelectFlipRow(&m_isa);
+        m_rows = host::SelectPixelRows(&m_isa);
+    }
+
+    std::string name(void) const override { return "host"; }
+    std::string description(void) const override {
+        return std::to_string(m_pool.size()) + " threads, " + m_isa;
+    }
+
+    void Run(const std::string &command, const PixelParams &params, size_t reps, size_t width, size_t height) override {
+        for (size_t repetition = 0; repetition < reps; repetition++) {
+            if(command == "flip")
+                host::Flip(m_pool, m_flip_row, m_a, m_out, width, height);
+            else if(command == "brighten")
+                host::Brighten(m_pool, m_rows.brighten, params.brighten, m_a, m_out, m_size);
+            else if(command == "blend")
+                host::Blend(m_pool, m_rows.blend, params.blend, m_a, m_a2, m_out, m_size);
+            else if(command == "diff")
+                host::Diff(m_pool, m_rows.diff, m_a, m_a2, m_out, m_size);
+        }
+    }
+
+private:
+    host::ThreadPool m_pool;
+    const char *m_isa = nullptr;
+    host::FlipRowFn m_flip_row;
+    host::PixelRowFns m_rows;
+};
+
+// Flip sharded over every SYCL device, same as --engine=multi
+class MultiEngine : public Engine {
+public:
+    explicit MultiEngine(const PixelParams &params) : Engine(params), m_shards(exception_handler) {}
+
+    std::string name(void) const override { return "multi"; }
+    std::string description(void) const override {
+        std::string names;
+        for (auto &shard : m_shards.shards())
+            names += (names.empty() ? "" : " + ") + shard.name;
+        return names;
+    }
+    bool supports(const std::string &command) const override { return command == "flip"; }
+
+    void Run(const std::string &command, const PixelParams &params, size_t reps, size_t width, size_t height) override {
+        for (size_t repetition = 0; repetition < reps; repetition++)
+            m_shards.Flip(m_a, m_out, width, height);
+    }
+
+private:
+    multi::DeviceShards m_shards;
+};
+
+int main(int argc, char * argv[]) {
+    bench::Suite suite;
+    suite.commands = {"flip", "brighten", "blend", "diff"};
+    suite.two_input_commands = {"blend", "diff"};
+    suite.engines = {"sycl", "host", "multi"};
+    suite.default_engines = {"sycl", "host"};
+    suite.params = {{"gain", 100, "brighten gain in percent"},
+                    {"offset", 0, "brighten offset"},
+                    {"weight", 50, "blend weight in percent"},
+                    {"threads", 0, "host engine threads, 0 for all", 0}};
+    suite.make_engine = [](const std::string &name, const bench::Config &config) -> bench::Engine * {
+        PixelParams params{px::MakeBrighten(config.param("gain"), config.param("offset")),
+                           px::MakeBlend(config.param("weight"))};
+        if(name == "sycl") {
+            #if FPGA_EMULATOR
+            return new SyclEngine(sycl::ext::intel::fpga_emulator_selector_v, params);
+            #elif FPGA_SIMULATOR
+            return new SyclEngine(sycl::ext::intel::fpga_simulator_selector_v, params);
+            #elif FPGA_HARDWARE
+            return new SyclEngine(sycl::ext::intel::fpga_selector_v, params);
+            #else
+            return new SyclEngine(sycl::default_selector_v, params);
+            #endif
+        } else if(name == "host") {
+            size_t threads = config.param("threads");
+            return new HostEngine(threads == 0 ? std::thread::hardware_concurrency() : threads, params);
+        } else if(name == "multi") {
+            return new MultiEngine(params);
+        }
+        return nullptr;
+    };
+    return bench::Main(argc, argv, suite);
+}
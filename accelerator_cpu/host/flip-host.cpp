@@ -0,0 +1,168 @@
+#include <vector>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include "PngImage.hpp"
+#include "ImageStages.hpp"
+#include "HostEngine.hpp"
+#include "Perf.hpp"
+#include "Verify.hpp"
+
+// The vector-add-buffers flip on the host engine alone. Nothing here includes
+// SYCL, so it builds with g++ on machines without oneAPI.
+
+void Help(void) {
+    std::cout << "flip-host -i=<input file> -o=<output file> [options] <# repetitions>\n";
+    std::cout << "  -h,--help                                : this help text\n";
+    std::cout << "  -p,--perf                                : print the time spent in each stage\n";
+    std::cout << "  --verify                                 : check the output against a plain loop\n";
+    std::cout << "  --threads=<n>                            : worker threads (default all)\n";
+    std::cout << "  Reads ../in/<input file> and writes ../out/<output file>, like vector-add-buffers.\n";
+}
+
+// Value of the argument if it starts with prefix, else nullptr
+const char *ArgValue(const std::string &arg, const char *prefix) {
+    if(arg.compare(0, strlen(prefix), prefix) != 0)
+        return nullptr;
+    return arg.c_str() + strlen(prefix);
+}
+
+int main(int argc, char * argv[]) {
+    std::string infilename = "";
+    std::string outfilename = "";
+    bool help = false;
+    bool perf_report = false;
+    bool verify_output = false;
+    long threads_arg = 0;
+
+    if(argc < 4) {
+        std::cerr << "Incorrect number of arguments. Correct usage: "
+                  << argv[0] << " -i=<input-file> -o=<output-file> [options] <# repetitions>" << std::endl;
+        return 1;
+    }
+
+    for(int i = 1; i < argc-1; i++) {
+        std::string sarg(argv[i]);
+        const char *value = nullptr;
+        if(sarg == "-h" || sarg == "--help")
+            help = true;
+        else if(sarg == "-p" || sarg == "--perf")
+            perf_report = true;
+        else if(sarg == "--verify")
+            verify_output = true;
+        else if((value = ArgValue(sarg, "-i=")) != nullptr || (value = ArgValue(sarg, "-in=")) != nullptr)
+            infilename = value;
+        else if((value = ArgValue(sarg, "-o=")) != nullptr || (value = ArgValue(sarg, "-out=")) != nullptr)
+            outfilename = value;
+        else if((value = ArgValue(sarg, "--threads=")) != nullptr)
+            threads_arg = atol(value);
+        else {
+            std::cerr << "Unknown argument '" << sarg << "'" << std::endl;
+            help = true;
+        }
+    }
+
+    if(help) {
+        Help();
+        return 1;
+    }
+
+    long num_repetitions = atol(argv[argc-1]);
+    if(num_repetitions < 1 || threads_arg < 0) {
+        std::cerr << "The repetitions must be at least 1 and --threads at least 0" << std::endl;
+        return 1;
+    }
+    if(infilename.empty() || outfilename.empty()) {
+        std::cerr << "flip-host needs -i=<input-file> and -o=<output-file>" << std::endl;
+        return 1;
+    }
+    if(perf_report) {
+        perf::SetPeak(perf::MeasureStreamCopy(), "host STREAM copy");
+        perf::Enable();
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    perf::ScopedZone decode("PNG decode");
+    img::PNG png(std::filesystem::path("../in/" + infilename));
+    decode.End();
+    img::PNG_PIXEL_RGBA_16_ROWS indata;
+    {
+        PERF_ZONE("asRGBA16");
+        indata = png.asRGBA16();
+    }
+    if(indata.empty()) {
+        std::cerr << "'" << infilename << "' has no pixels" << std::endl;
+        return 1;
+    }
+    size_t width = indata[0].size();
+    size_t height = indata.size();
+    perf::SetItems(width * height, "px");
+
+    std::vector<uint64_t> a, b;
+    {
+        PERF_ZONE("flatten");
+        stage::Flatten(indata, a);
+        b.resize(a.size());
+    }
+
+    perf::ScopedZone start("thread pool start");
+    host::ThreadPool pool(threads_arg == 0 ? std::thread::hardware_concurrency() : (size_t)threads_arg);
+    start.End();
+    const char *isa = nullptr;
+    host::FlipRowFn flip_row = host::SelectFlipRow(&isa);
+    std::cout << "Host engine: " << pool.size() << " threads, " << isa << " kernel\n";
+
+    auto start_time_compute = std::chrono::high_resolution_clock::now();
+    perf::ScopedZone kernel("kernel", num_repetitions * 2 * a.size() * sizeof(uint64_t));
+    for(long repetition = 0; repetition < num_repetitions; repetition++)
+        host::Flip(pool, flip_row, a.data(), b.data(), width, height);
+    kernel.End();
+    auto end_time_compute = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> process_time_compute(end_time_compute - start_time_compute);
+    std::cout << "Computation was " << process_time_compute.count() << " milliseconds\n";
+
+    bool verified = true;
+    if(verify_output) {
+        PERF_ZONE("verify");
+        verify::Result<uint64_t> result = verify::Check(b.data(), width, height, [&](size_t first, size_t rows, uint64_t *out) {
+            for(size_t r = 0; r < rows; r++)
+                for(size_t j = 0; j < width; j++)
+                    out[r * width + j] = a[(first + r) * width + width - 1 - j];
+        });
+        if(!result.ok) {
+            std::cerr << "Verification failed, first difference at row " << result.row << ", column " << result.col
+                      << ": expected 0x" << std::hex << result.expected << ", got 0x" << result.actual << std::dec << std::endl;
+            verified = false;
+        }
+    }
+
+    {
+        PERF_ZONE("unflatten");
+        stage::Unflatten(b, indata);
+    }
+    {
+        PERF_ZONE("fromRGBA16");
+        png.fromRGBA16(indata);
+    }
+    {
+        PERF_ZONE("saveToFile");
+        png.saveToFile(std::filesystem::path("../out/" + outfilename));
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> process_time(end_time - start_time);
+    std::cout << "Computation and I/O was " << process_time.count() << " milliseconds\n";
+
+    if(perf_report)
+        perf::PrintReport();
+
+    if(!verified) {
+        std::cerr << "Output does not match the reference" << std::endl;
+        return 1;
+    }
+    return 0;
+}
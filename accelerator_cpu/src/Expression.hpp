@@ -0,0 +1,437 @@
+#ifndef EXPRESSION_HPP__
+#define EXPRESSION_HPP__
+
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <cctype>
+#include <cstddef>
+
+// Lazily evaluated elementwise matrix expressions. Building (a + b) * c does
+// no work; VectorEvaluate then computes it in one kernel pass that reads each
+// input once per element and writes the output once, with no intermediates.
+//
+// Expressions come either from C++ at compile time,
+//	auto e = (expr::Input(a) + expr::Input(b)) * expr::Input(c);
+//	q.single_task(expr::VectorEvaluate<decltype(e), kLanes>{e, out, len});
+// or from a string at run time via expr::Parser. Instantiate() turns a parsed
+// tree of up to kMaxFusedHeight operators into the same compile-time
+// expression, so the kernel is a datapath for its shape. Taller expressions
+// fall back to ProgramExpr, a small stack program the kernel interprets per
+// element.
+namespace expr
+{
+	constexpr int kMaxInputs = 4;	// Inputs a, b, c, d
+
+	////////////////////////////////////////////////////////////////////////
+	// Compile-time expression tree
+
+	// The elementwise operators, shared with the VectorAdd, VectorSubtract
+	// and VectorMultiply kernels
+	struct Plus
+	{
+		template <typename T>
+		static T apply(T a, T b) { return a + b; }
+	};
+
+	struct Minus
+	{
+		template <typename T>
+		static T apply(T a, T b) { return a - b; }
+	};
+
+	struct Times
+	{
+		template <typename T>
+		static T apply(T a, T b) { return a * b; }
+	};
+
+	// Leaf reading one input matrix, or broadcasting a constant when ptr is
+	// null. Inputs and constants share the type so that a parsed tree has
+	// as few instantiations as it has shapes.
+	struct Operand
+	{
+		const int *ptr;
+		int value;
+
+		int operator()(size_t idx) const { return ptr != nullptr ? ptr[idx] : value; }
+	};
+
+	inline Operand Input(const int *ptr) { return Operand{ptr, 0}; }
+	inline Operand Constant(int value) { return Operand{nullptr, value}; }
+
+	template <typename Op, typename L, typename R>
+	struct Binary
+	{
+		L lhs;
+		R rhs;
+
+		int operator()(size_t idx) const { return Op::apply(lhs(idx), rhs(idx)); }
+	};
+
+	template <typename T> struct IsExpression : std::false_type {};
+	template <> struct IsExpression<Operand> : std::true_type {};
+	template <typename Op, typename L, typename R>
+	struct IsExpression<Binary<Op, L, R>> : std::true_type {};
+
+	template <typename L, typename R>
+	using EnableIfExpressions = std::enable_if_t<IsExpression<L>::value && IsExpression<R>::value>;
+
+	template <typename L, typename R, typename = EnableIfExpressions<L, R>>
+	Binary<Plus, L, R> operator+(L lhs, R rhs) { return {lhs, rhs}; }
+
+	template <typename L, typename R, typename = EnableIfExpressions<L, R>>
+	Binary<Minus, L, R> operator-(L lhs, R rhs) { return {lhs, rhs}; }
+
+	template <typename L, typename R, typename = EnableIfExpressions<L, R>>
+	Binary<Times, L, R> operator*(L lhs, R rhs) { return {lhs, rhs}; }
+
+	////////////////////////////////////////////////////////////////////////
+	// Run-time expressions, compiled to a small stack program
+
+	constexpr int kMaxProgram = 64;	// Instructions per expression
+	constexpr int kMaxStack = 16;	// Evaluation stack depth
+	constexpr int kMaxNesting = 32;	// Parentheses and negations inside each other
+
+	enum Opcode : int
+	{
+		kPushInput,
+		kPushConstant,
+		kAdd,
+		kSubtract,
+		kMultiply,
+		kNegate,
+	};
+
+	struct Instruction
+	{
+		int op;
+		int arg;
+	};
+
+	// The parsed expression as a tree. Node i is instruction i of the
+	// program; an operator's operands are the nodes lhs and rhs (a negation
+	// only has lhs).
+	struct Node
+	{
+		int op;
+		int arg;
+		int lhs;
+		int rhs;
+	};
+
+	struct Tree
+	{
+		Node nodes[kMaxProgram];
+		int root;
+		int height;		// Operators on the longest path from the root
+	};
+
+	// A parsed program and the inputs it reads. It is held by value, so it
+	// is copied into the kernel with the functor.
+	struct ProgramExpr
+	{
+		Instruction code[kMaxProgram];
+		int length;
+		int used;			// Bit k is set if input k appears
+		const int *inputs[kMaxInputs];
+
+		int operator()(size_t idx) const
+		{
+			// Each input once, however often the expression names it
+			int value[kMaxInputs] = {0};
+			for (int k = 0; k < kMaxInputs; k++)
+			{
+				if (used & (1 << k))
+					value[k] = inputs[k][idx];
+			}
+
+			int stack[kMaxStack] = {0};
+			int top = 0;
+			for (int pc = 0; pc < length; pc++)
+			{
+				Instruction ins = code[pc];
+				switch (ins.op)
+				{
+					case kPushInput:
+						stack[top++] = value[ins.arg];
+						break;
+					case kPushConstant:
+						stack[top++] = ins.arg;
+						break;
+					case kAdd:
+						top--;
+						stack[top - 1] = stack[top - 1] + stack[top];
+						break;
+					case kSubtract:
+						top--;
+						stack[top - 1] = stack[top - 1] - stack[top];
+						break;
+					case kMultiply:
+						top--;
+						stack[top - 1] = stack[top - 1] * stack[top];
+						break;
+					case kNegate:
+						stack[top - 1] = -stack[top - 1];
+						break;
+				}
+			}
+			return stack[0];
+		}
+	};
+
+	// Recursive descent parser for
+	//	expr   := term (('+' | '-') term)*
+	//	term   := factor ('*' factor)*
+	//	factor := 'a'..'d' | integer | '(' expr ')' | '-' factor
+	class Parser
+	{
+	public:
+		Parser(const std::string &text) : m_text(text) {}
+
+		ProgramExpr parse(void)
+		{
+			m_program = ProgramExpr{};
+			m_tree = Tree{};
+			m_pos = 0;
+			m_depth = 0;
+			m_max_depth = 0;
+			m_nesting = 0;
+			m_inputs_used = 0;
+
+			m_tree.root = parseExpr();
+			m_tree.height = m_heights[m_tree.root];
+			skipSpace();
+			if (m_pos != m_text.size())
+				fail("unexpected '" + std::string(1, m_text[m_pos]) + "'");
+			m_program.used = m_inputs_used;
+			return m_program;
+		}
+
+		// The expression parse() read, as a tree
+		const Tree &tree(void) const { return m_tree; }
+
+		// Bit i is set if input i ('a' + i) appears in the expression
+		int inputsUsed(void) const { return m_inputs_used; }
+
+	private:
+		// Each parse step returns the node it read
+		int parseExpr(void)
+		{
+			int node = parseTerm();
+			for (;;)
+			{
+				skipSpace();
+				if (accept('+'))
+					node = emit(kAdd, 0, -1, node, parseTerm());
+				else if (accept('-'))
+					node = emit(kSubtract, 0, -1, node, parseTerm());
+				else
+					return node;
+			}
+		}
+
+		int parseTerm(void)
+		{
+			int node = parseFactor();
+			for (;;)
+			{
+				skipSpace();
+				if (accept('*'))
+					node = emit(kMultiply, 0, -1, node, parseFactor());
+				else
+					return node;
+			}
+		}
+
+		int parseFactor(void)
+		{
+			skipSpace();
+			if (m_pos >= m_text.size())
+				fail("unexpected end of expression");
+
+			char ch = m_text[m_pos];
+			int node;
+			if (accept('('))
+			{
+				nest();
+				node = parseExpr();
+				m_nesting--;
+				skipSpace();
+				if (!accept(')'))
+					fail("missing ')'");
+			}
+			else if (accept('-'))
+			{
+				nest();
+				node = emit(kNegate, 0, 0, parseFactor(), -1);
+				m_nesting--;
+			}
+			else if (ch >= 'a' && ch < 'a' + kMaxInputs)
+			{
+				m_pos++;
+				m_inputs_used |= 1 << (ch - 'a');
+				node = emit(kPushInput, ch - 'a', 1, -1, -1);
+			}
+			else if (std::isdigit(static_cast<unsigned char>(ch)))
+			{
+				size_t used = 0;
+				int value = 0;
+				try
+				{
+					value = std::stoi(m_text.substr(m_pos), &used);
+				}
+				catch (std::out_of_range const &)
+				{
+					fail("constant out of range");
+				}
+				m_pos += used;
+				node = emit(kPushConstant, value, 1, -1, -1);
+			}
+			else
+				fail("unexpected '" + std::string(1, ch) + "'");
+			return node;
+		}
+
+		// Every '(' and unary '-' recurses, so their nesting is bounded
+		// before the call stack is
+		void nest(void)
+		{
+			if (++m_nesting > kMaxNesting)
+				fail("expression is nested too deeply");
+		}
+
+		int emit(int op, int arg, int stack_change, int lhs, int rhs)
+		{
+			if (m_program.length == kMaxProgram)
+				fail("expression is too long");
+			int node = m_program.length;
+			m_program.code[m_program.length++] = Instruction{op, arg};
+			m_tree.nodes[node] = Node{op, arg, lhs, rhs};
+			m_heights[node] = 0;
+			if (lhs >= 0)
+				m_heights[node] = m_heights[lhs] + 1;
+			if (rhs >= 0 && m_heights[rhs] + 1 > m_heights[node])
+				m_heights[node] = m_heights[rhs] + 1;
+			m_depth += stack_change;
+			if (m_depth > m_max_depth)
+				m_max_depth = m_depth;
+			if (m_max_depth > kMaxStack)
+				fail("expression is nested too deeply");
+			return node;
+		}
+
+		bool accept(char ch)
+		{
+			if (m_pos < m_text.size() && m_text[m_pos] == ch)
+			{
+				m_pos++;
+				return true;
+			}
+			return false;
+		}
+
+		void skipSpace(void)
+		{
+			while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos])))
+				m_pos++;
+		}
+
+		void fail(const std::string &what)
+		{
+			throw std::runtime_error("Bad expression '" + m_text + "': " + what);
+		}
+
+		std::string m_text;
+		ProgramExpr m_program;
+		Tree m_tree;
+		int m_heights[kMaxProgram];	// Height of the tree below each node
+		size_t m_pos = 0;
+		int m_depth = 0;
+		int m_max_depth = 0;
+		int m_nesting = 0;
+		int m_inputs_used = 0;
+	};
+
+	////////////////////////////////////////////////////////////////////////
+	// Parsed trees as compile-time expressions
+
+	// Trees up to this many operators high get a kernel of their own. Every
+	// shape is one instantiation of VectorEvaluate: 4 fit in one operator,
+	// 49 in two, 7204 in three, so taller trees are interpreted instead.
+	constexpr int kMaxFusedHeight = 2;
+
+	// Call launch(e) with the tree below node as the expression e, built from
+	// Operand and Binary, reading input k from inputs[k]. A negation becomes
+	// 0 - x. Returns false, without calling launch, if the tree is more
+	// than Height operators high.
+	template <int Height, typename Launch>
+	bool Instantiate(const Tree &tree, int node, const int *const inputs[], Launch &&launch)
+	{
+		const Node &n = tree.nodes[node];
+		if (n.op == kPushInput)
+		{
+			launch(Input(inputs[n.arg]));
+			return true;
+		}
+		if (n.op == kPushConstant)
+		{
+			launch(Constant(n.arg));
+			return true;
+		}
+		if constexpr (Height == 0)
+			return false;
+		else
+		{
+			if (n.op == kNegate)
+			{
+				return Instantiate<Height - 1>(tree, n.lhs, inputs, [&](auto operand)
+				{
+					launch(Constant(0) - operand);
+				});
+			}
+			bool fits = true;
+			bool found = Instantiate<Height - 1>(tree, n.lhs, inputs, [&](auto lhs)
+			{
+				fits = Instantiate<Height - 1>(tree, n.rhs, inputs, [&](auto rhs)
+				{
+					if (n.op == kAdd)
+						launch(lhs + rhs);
+					else if (n.op == kSubtract)
+						launch(lhs - rhs);
+					else
+						launch(lhs * rhs);
+				});
+			});
+			return found && fits;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	// Kernel
+
+	// Evaluate any expression over len elements in a single pass, Lanes
+	// elements per loop iteration like the other elementwise kernels
+	template <typename E, int Lanes>
+	struct VectorEvaluate
+	{
+		E expression;
+		int *const c_out;
+		size_t len;
+
+		void operator()() const
+		{
+			for (size_t base = 0; base < len; base += Lanes)
+			{
+				#pragma unroll
+				for (int lane = 0; lane < Lanes; lane++)
+				{
+					size_t idx = base + lane;
+					if (idx < len)
+						c_out[idx] = expression(idx);
+				}
+			}
+		}
+	};
+} // namespace expr
+#endif // EXPRESSION_HPP__
@@ -0,0 +1,311 @@
+#ifndef HOST_ENGINE_HPP__
+#define HOST_ENGINE_HPP__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include "PixelMath.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HOST_ENGINE_X86 1
+#endif
+
+// Pure host implementation of the image kernels. Nothing in here touches the
+// SYCL runtime, so it doubles as a bandwidth baseline for the device engines
+// and as the production path on machines without a working oneAPI install.
+namespace host
+{
+  // Fixed pool of worker threads. Run() splits [0, count) into one contiguous
+  // range per worker and blocks until every range has been processed.
+  class ThreadPool {
+  public:
+    ThreadPool(size_t num_threads = std::thread::hardware_concurrency()) {
+      if(num_threads == 0)
+        num_threads = 1;
+      m_num_threads = num_threads;
+      // The calling thread takes the first range, so spawn one less
+      for(size_t i = 1; i < num_threads; i++)
+        m_workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    ~ThreadPool(void) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_start.notify_all();
+      for(auto &worker : m_workers)
+        worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size(void) const {
+      return m_num_threads;
+    }
+
+    void Run(size_t count, std::function<void(size_t, size_t)> task) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = std::move(task);
+        m_count = count;
+        m_pending = m_workers.size();
+        m_generation++;
+      }
+      m_start.notify_all();
+
+      runRange(0);
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done.wait(lock, [this]() { return m_pending == 0; });
+    }
+
+  private:
+    void runRange(size_t index) {
+      size_t chunk = (m_count + m_num_threads - 1) / m_num_threads;
+      size_t begin = std::min(m_count, index * chunk);
+      size_t end   = std::min(m_count, begin + chunk);
+      if(begin < end)
+        m_task(begin, end);
+    }
+
+    void workerLoop(size_t index) {
+      size_t seen = 0;
+      for(;;) {
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_start.wait(lock, [&]() { return m_stop || m_generation != seen; });
+          if(m_stop)
+            return;
+          seen = m_generation;
+        }
+
+        runRange(index);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_pending == 0)
+          m_done.notify_one();
+      }
+    }
+
+    std::vector<std::thread>               m_workers;
+    std::mutex                             m_mutex;
+    std::condition_variable                m_start;
+    std::condition_variable                m_done;
+    std::function<void(size_t, size_t)>    m_task;
+    size_t                                 m_num_threads = 1;
+    size_t                                 m_count       = 0;
+    size_t                                 m_pending     = 0;
+    size_t                                 m_generation  = 0;
+    bool                                   m_stop        = false;
+  };
+
+  // Reverse one row of packed RGBA16 pixels: out[j] = in[width - 1 - j]
+  typedef void (*FlipRowFn)(const uint64_t*, uint64_t*, size_t);
+
+  static inline void FlipRowScalar(const uint64_t* in, uint64_t* out, size_t width) {
+    for(size_t j = 0; j < width; j++)
+      out[j] = in[width - 1 - j];
+  }
+
+#if HOST_ENGINE_X86
+  // 4 x u64 per step, reversed in register with vpermq
+  __attribute__((target("avx2")))
+  static inline void FlipRowAVX2(const uint64_t* in, uint64_t* out, size_t width) {
+    size_t j = 0;
+    for(; j + 4 <= width; j += 4) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(in + width - 4 - j));
+      _mm256_storeu_si256((__m256i*)(out + j), _mm256_permute4x64_epi64(v, 0x1B));
+    }
+    for(; j < width; j++)
+      out[j] = in[width - 1 - j];
+  }
+
+  // 8 x u64 per step, reversed in register with vpermq (zmm). GCC warns
+  // that the undefined source _mm512_permutexvar_epi64 passes to its
+  // masked builtin may be used uninitialized; no lane of it is.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+  __attribute__((target("avx512f")))
+  static inline void FlipRowAVX512(const uint64_t* in, uint64_t* out, size_t width) {
+    const __m512i reverse = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    size_t j = 0;
+    for(; j + 8 <= width; j += 8) {
+      __m512i v = _mm512_loadu_si512((const void*)(in + width - 8 - j));
+      _mm512_storeu_si512((void*)(out + j), _mm512_permutexvar_epi64(reverse, v));
+    }
+    for(; j < width; j++)
+      out[j] = in[width - 1 - j];
+  }
+#pragma GCC diagnostic pop
+#endif
+
+  // Pick the widest reverse kernel the running CPU supports
+  static inline FlipRowFn SelectFlipRow(const char** name = nullptr) {
+    const char* selected = "scalar";
+    FlipRowFn fn = FlipRowScalar;
+#if HOST_ENGINE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) {
+      selected = "avx512";
+      fn = FlipRowAVX512;
+    } else if(__builtin_cpu_supports("avx2")) {
+      selected = "avx2";
+      fn = FlipRowAVX2;
+    }
+#endif
+    if(name != nullptr)
+      *name = selected;
+    return fn;
+  }
+
+  // Flip a row-major width x height image, rows partitioned across the pool
+  static inline void Flip(ThreadPool &pool, FlipRowFn flip_row,
+                          const uint64_t* in, uint64_t* out, size_t width, size_t height) {
+    pool.Run(height, [=](size_t begin, size_t end) {
+      for(size_t i = begin; i < end; i++)
+        flip_row(in + i * width, out + i * width, width);
+    });
+  }
+
+  // Per-channel pixel arithmetic over count packed pixels. The scalar rows
+  // run the SWAR math from PixelMath.hpp; the SIMD rows must match it bit
+  // for bit, including rounding.
+  typedef void (*BrightenRowFn)(const uint64_t*, uint64_t*, size_t, const px::Brighten&);
+  typedef void (*BlendRowFn)(const uint64_t*, const uint64_t*, uint64_t*, size_t, const px::Blend&);
+  typedef void (*DiffRowFn)(const uint64_t*, const uint64_t*, uint64_t*, size_t);
+
+  struct PixelRowFns {
+    BrightenRowFn brighten;
+    BlendRowFn    blend;
+    DiffRowFn     diff;
+  };
+
+  static inline void BrightenRowScalar(const uint64_t* in, uint64_t* out, size_t count, const px::Brighten& op) {
+    for(size_t j = 0; j < count; j++)
+      out[j] = op(in[j]);
+  }
+
+  static inline void BlendRowScalar(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t count, const px::Blend& op) {
+    for(size_t j = 0; j < count; j++)
+      out[j] = op(a[j], b[j]);
+  }
+
+  static inline void DiffRowScalar(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t count) {
+    px::Diff op;
+    for(size_t j = 0; j < count; j++)
+      out[j] = op(a[j], b[j]);
+  }
+
+#if HOST_ENGINE_X86
+  // Alpha is the low word of every pixel, words 0 and 4 of each 128-bit lane
+  constexpr int kAlphaWords = 0x11;
+
+  // (x * w + round) >> Shift per u16 lane, widened to 32 bits and packed
+  // back with unsigned saturation
+  template <int Shift>
+  __attribute__((target("avx2")))
+  static inline __m256i MulShiftU16(__m256i x, __m256i w, __m256i round) {
+    __m256i lo = _mm256_mullo_epi16(x, w);
+    __m256i hi = _mm256_mulhi_epu16(x, w);
+    __m256i p0 = _mm256_srli_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round), Shift);
+    __m256i p1 = _mm256_srli_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round), Shift);
+    return _mm256_packus_epi32(p0, p1);
+  }
+
+  __attribute__((target("avx2")))
+  static inline void BrightenRowAVX2(const uint64_t* in, uint64_t* out, size_t count, const px::Brighten& op) {
+    const __m256i gain  = _mm256_set1_epi16((short)op.gain);
+    const __m256i round = _mm256_set1_epi32(1 << 7);
+    const __m256i add   = _mm256_set1_epi64x((long long)op.offset_add);
+    const __m256i sub   = _mm256_set1_epi64x((long long)op.offset_sub);
+    size_t j = 0;
+    for(; j + 4 <= count; j += 4) {
+      __m256i p = _mm256_loadu_si256((const __m256i*)(in + j));
+      __m256i v = MulShiftU16<8>(p, gain, round);
+      v = _mm256_adds_epu16(_mm256_subs_epu16(v, sub), add);
+      _mm256_storeu_si256((__m256i*)(out + j), _mm256_blend_epi16(v, p, kAlphaWords));
+    }
+    BrightenRowScalar(in + j, out + j, count - j, op);
+  }
+
+  __attribute__((target("avx2")))
+  static inline void BlendRowAVX2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t count, const px::Blend& op) {
+    const __m256i wa    = _mm256_set1_epi16((short)op.weight);
+    const __m256i wb    = _mm256_set1_epi16((short)(px::kWeightOne - op.weight));
+    const __m256i round = _mm256_set1_epi32(1 << 14);
+    size_t j = 0;
+    for(; j + 4 <= count; j += 4) {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(a + j));
+      __m256i y = _mm256_loadu_si256((const __m256i*)(b + j));
+      __m256i xl = _mm256_mullo_epi16(x, wa), xh = _mm256_mulhi_epu16(x, wa);
+      __m256i yl = _mm256_mullo_epi16(y, wb), yh = _mm256_mulhi_epu16(y, wb);
+      __m256i s0 = _mm256_add_epi32(_mm256_unpacklo_epi16(xl, xh), _mm256_unpacklo_epi16(yl, yh));
+      __m256i s1 = _mm256_add_epi32(_mm256_unpackhi_epi16(xl, xh), _mm256_unpackhi_epi16(yl, yh));
+      s0 = _mm256_srli_epi32(_mm256_add_epi32(s0, round), 15);
+      s1 = _mm256_srli_epi32(_mm256_add_epi32(s1, round), 15);
+      __m256i v = _mm256_packus_epi32(s0, s1);
+      _mm256_storeu_si256((__m256i*)(out + j), _mm256_blend_epi16(v, x, kAlphaWords));
+    }
+    BlendRowScalar(a + j, b + j, out + j, count - j, op);
+  }
+
+  __attribute__((target("avx2")))
+  static inline void DiffRowAVX2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t count) {
+    size_t j = 0;
+    for(; j + 4 <= count; j += 4) {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(a + j));
+      __m256i y = _mm256_loadu_si256((const __m256i*)(b + j));
+      __m256i v = _mm256_or_si256(_mm256_subs_epu16(x, y), _mm256_subs_epu16(y, x));
+      _mm256_storeu_si256((__m256i*)(out + j), _mm256_blend_epi16(v, x, kAlphaWords));
+    }
+    DiffRowScalar(a + j, b + j, out + j, count - j);
+  }
+#endif
+
+  // Pick the widest pixel arithmetic kernels the running CPU supports
+  static inline PixelRowFns SelectPixelRows(const char** name = nullptr) {
+    const char* selected = "scalar";
+    PixelRowFns fns{BrightenRowScalar, BlendRowScalar, DiffRowScalar};
+#if HOST_ENGINE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+      selected = "avx2";
+      fns = PixelRowFns{BrightenRowAVX2, BlendRowAVX2, DiffRowAVX2};
+    }
+#endif
+    if(name != nullptr)
+      *name = selected;
+    return fns;
+  }
+
+  // Pixels are independent, so the image is split as one flat range
+  static inline void Brighten(ThreadPool &pool, BrightenRowFn row, const px::Brighten &op,
+                              const uint64_t* in, uint64_t* out, size_t count) {
+    pool.Run(count, [=, &op](size_t begin, size_t end) {
+      row(in + begin, out + begin, end - begin, op);
+    });
+  }
+
+  static inline void Blend(ThreadPool &pool, BlendRowFn row, const px::Blend &op,
+                           const uint64_t* a, const uint64_t* b, uint64_t* out, size_t count) {
+    pool.Run(count, [=, &op](size_t begin, size_t end) {
+      row(a + begin, b + begin, out + begin, end - begin, op);
+    });
+  }
+
+  static inline void Diff(ThreadPool &pool, DiffRowFn row,
+                          const uint64_t* a, const uint64_t* b, uint64_t* out, size_t count) {
+    pool.Run(count, [=](size_t begin, size_t end) {
+      row(a + begin, b + begin, out + begin, end - begin);
+    });
+  }
+} // namespace host
+#endif // HOST_ENGINE_HPP__
@@ -0,0 +1,66 @@
+#ifndef IMAGE_STAGES_HPP__
+#define IMAGE_STAGES_HPP__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "PngImage.hpp"
+
+// The steps every image command takes between the PNG rows and the kernels,
+// and the kernels' per-row bodies. vector-add-buffers and the bench both
+// call these, so the bench times the same code the driver runs.
+namespace stage
+{
+  // 16-bit RGBA rows -> one packed r << 48 | g << 32 | b << 16 | a per pixel,
+  // row-major
+  static inline void Flatten(const img::PNG_PIXEL_RGBA_16_ROWS &rows, std::vector<uint64_t> &flat) {
+    size_t width = rows.empty() ? 0 : rows[0].size();
+    flat.resize(rows.size() * width);
+    uint64_t *dst = flat.data();
+    for (auto &row : rows)
+      for (auto &pixel : row)
+        *dst++ = static_cast<uint64_t>(pixel);
+  }
+
+  static inline img::PNG_PIXEL_RGBA_16 Unpack(uint64_t val) {
+    img::PNG_PIXEL_RGBA_16 pixel;
+    pixel.rgba.r = (uint16_t)(val >> 48);
+    pixel.rgba.g = (uint16_t)(val >> 32);
+    pixel.rgba.b = (uint16_t)(val >> 16);
+    pixel.rgba.a = (uint16_t)val;
+    return pixel;
+  }
+
+  // Packed pixels back into rows already sized to the image
+  static inline void Unflatten(const std::vector<uint64_t> &flat, img::PNG_PIXEL_RGBA_16_ROWS &rows) {
+    const uint64_t *src = flat.data();
+    for (auto &row : rows)
+      for (auto &pixel : row)
+        pixel = Unpack(*src++);
+  }
+
+  // Kernel bodies for row `row` of a width-wide image. a, b and c are
+  // accessors or pointers.
+
+  // b = a mirrored left to right
+  template <typename In, typename Out>
+  static inline void FlipRow(const In &a, const Out &b, size_t row, size_t width) {
+    for (size_t j = 0; j < width; j++)
+      b[(row*width)+j] = a[(row*width)+(width-1-j)];
+  }
+
+  // b = op(a) per pixel
+  template <typename In, typename Out, typename PixelOp>
+  static inline void MapRow(const In &a, const Out &b, size_t row, size_t width, PixelOp op) {
+    for (size_t j = 0; j < width; j++)
+      b[(row*width)+j] = op(a[(row*width)+j]);
+  }
+
+  // c = op(a, b) per pixel
+  template <typename In1, typename In2, typename Out, typename PixelOp>
+  static inline void MapRow(const In1 &a, const In2 &b, const Out &c, size_t row, size_t width, PixelOp op) {
+    for (size_t j = 0; j < width; j++)
+      c[(row*width)+j] = op(a[(row*width)+j], b[(row*width)+j]);
+  }
+} // namespace stage
+#endif // IMAGE_STAGES_HPP__
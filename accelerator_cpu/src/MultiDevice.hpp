@@ -0,0 +1,151 @@
+#ifndef MULTI_DEVICE_HPP__
+#define MULTI_DEVICE_HPP__
+
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <exception>
+
+#include "Trace.hpp"
+
+// Forward declare the kernel name in the global scope.
+class MultiFlipKernel;
+
+// Runs a kernel across every SYCL device in the system that can run it. Rows
+// are handed out in guided chunks from a shared cursor, each chunk sized by
+// the device's measured throughput, so a slow device only ever holds a small
+// tail.
+namespace multi
+{
+  struct Shard {
+    sycl::queue q;
+    std::string name;
+    double      rows_per_ms;  // Running throughput estimate, 0 until measured
+    size_t      rows_done;    // Rows processed in the last call
+  };
+
+  class DeviceShards {
+  public:
+    // Devices the flip kernel was not built for, or whose queue cannot be
+    // created, are left out with a note
+    template <typename Handler>
+    DeviceShards(Handler exception_handler) {
+      for(auto &device : sycl::device::get_devices()) {
+        std::string name = device.get_info<sycl::info::device::name>();
+        if(!sycl::is_compatible<MultiFlipKernel>(device)) {
+          std::cerr << "Skipping " << name << ": the flip kernel was not built for it\n";
+          continue;
+        }
+        try {
+          Shard shard{sycl::queue(device, exception_handler, perf::QueueProperties()), name, 0.0, 0};
+          m_shards.push_back(std::move(shard));
+        } catch (sycl::exception const &e) {
+          std::cerr << "Skipping " << name << ": " << e.what() << "\n";
+        }
+      }
+      if(m_shards.empty())
+        throw std::runtime_error("No SYCL device can run the flip kernel");
+    }
+
+    size_t size(void) const {
+      return m_shards.size();
+    }
+
+    const std::vector<Shard>& shards(void) const {
+      return m_shards;
+    }
+
+    // Flip a row-major width x height image across all devices. If a device
+    // throws, the others stop taking rows and the first exception is
+    // rethrown here once every worker has returned.
+    void Flip(const uint64_t* in, uint64_t* out, size_t width, size_t height) {
+      std::atomic<size_t> next_row{0};
+      std::vector<std::thread> workers;
+      std::exception_ptr failure;
+
+      for(auto &shard : m_shards)
+        shard.rows_done = 0;
+
+      for(size_t s = 0; s < m_shards.size(); s++) {
+        workers.emplace_back([&, s]() {
+          Shard &shard = m_shards[s];
+          try {
+            for(;;) {
+              PERF_ZONE("chunk");
+              size_t rows  = chunkRows(s, height - std::min(height, next_row.load()));
+              size_t begin = next_row.fetch_add(rows);
+              if(begin >= height)
+                break;
+              rows = std::min(rows, height - begin);
+
+              auto start = std::chrono::high_resolution_clock::now();
+              {
+                sycl::buffer<uint64_t, 1> a_buf(in + begin * width, sycl::range<1>(rows * width));
+                sycl::buffer<uint64_t, 1> b_buf(out + begin * width, sycl::range<1>(rows * width));
+                sycl::event e = shard.q.submit([&](sycl::handler &h) {
+                  sycl::accessor a(a_buf, h, sycl::read_only);
+                  sycl::accessor b(b_buf, h, sycl::write_only, sycl::no_init);
+                  h.parallel_for<MultiFlipKernel>(sycl::range<1>(rows), [=](auto i) { // for each row
+                    for(size_t j = 0; j < width; j++)
+                      b[(i * width) + j] = a[(i * width) + (width - 1 - j)]; // flip
+                  });
+                });
+                perf::TraceEvent(e, shard.name, "flip rows", 2 * rows * width * sizeof(uint64_t));
+              } // Buffer destruction writes the chunk back
+              auto end = std::chrono::high_resolution_clock::now();
+              std::chrono::duration<double, std::milli> elapsed(end - start);
+
+              std::lock_guard<std::mutex> lock(m_mutex);
+              double measured = rows / std::max(elapsed.count(), 1e-3);
+              shard.rows_per_ms = shard.rows_per_ms == 0.0 ? measured
+                                    : kSmoothing * measured + (1.0 - kSmoothing) * shard.rows_per_ms;
+              shard.rows_done += rows;
+            }
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!failure)
+              failure = std::current_exception();
+            next_row = height;
+          }
+        });
+      }
+
+      for(auto &worker : workers)
+        worker.join();
+      if(failure)
+        std::rethrow_exception(failure);
+    }
+
+  private:
+    // Guided scheduling: take this device's throughput share of half the
+    // remaining rows. Chunks shrink as the image drains, so the last chunk on
+    // any device is short no matter how slow it is. A device that has not
+    // reported yet only gets a kMinChunkRows probe, so a slow one cannot
+    // take a large share before its speed is known.
+    size_t chunkRows(size_t s, size_t remaining) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      double mine = m_shards[s].rows_per_ms;
+      if(mine == 0.0)
+        return kMinChunkRows;
+      double total = 0.0;
+      for(auto &shard : m_shards)
+        total += shard.rows_per_ms;
+
+      size_t rows = static_cast<size_t>(remaining * (mine / total) / 2.0);
+      return std::max(rows, kMinChunkRows);
+    }
+
+    static constexpr double kSmoothing    = 0.5;  // Weight of the newest measurement
+    static constexpr size_t kMinChunkRows = 16;   // Keep launch overhead amortized
+
+    std::vector<Shard> m_shards;
+    std::mutex         m_mutex;
+  };
+} // namespace multi
+#endif // MULTI_DEVICE_HPP__
@@ -0,0 +1,323 @@
+#ifndef PIPELINE_HPP__
+#define PIPELINE_HPP__
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io.hpp"
+#include "Matrix.hpp"
+#include "Perf.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Streaming CSV pipeline
+// The inputs are read a block of rows at a time. Three threads pass a fixed
+// pool of blocks around a ring of bounded queues:
+//	parse   : read the next rows of every input and parse them into the block
+//	compute : run the kernel on the block
+//	write   : format the block's result and append it to the output
+// Blocks come back to the parser once written, so memory stays at kDepth
+// blocks whatever the file size, and parsing block n + 1 overlaps computing
+// block n and writing block n - 1. Blocks stay in row order throughout.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace stream {
+	constexpr size_t kBlockBytes = 8 << 20;	// Text of the first input per block
+	constexpr size_t kReadBytes = 1 << 20;	// Bytes per read() of an input
+	constexpr size_t kDepth = 3;		// Blocks in flight, one per stage
+
+	// FIFO of at most capacity items. pop() waits for an item and returns
+	// false once the queue is closed and drained.
+	template <typename T>
+	class BoundedQueue {
+	public:
+		explicit BoundedQueue(size_t capacity) : m_capacity(capacity) {}
+
+		void push(T item) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_not_full.wait(lock, [this]() { return m_items.size() < m_capacity; });
+			m_items.push_back(std::move(item));
+			m_not_empty.notify_one();
+		}
+
+		bool pop(T &item) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_not_empty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+			if(m_items.empty())
+				return false;
+			item = std::move(m_items.front());
+			m_items.pop_front();
+			m_not_full.notify_one();
+			return true;
+		}
+
+		void close(void) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+			m_not_empty.notify_all();
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_not_empty;
+		std::condition_variable m_not_full;
+		std::deque<T> m_items;
+		size_t m_capacity;
+		bool m_closed = false;
+	};
+
+	// Whole lines of a file, read through one buffer that only holds the
+	// lines not yet taken plus one read
+	class LineReader {
+	public:
+		explicit LineReader(const std::string &path) {
+			m_fd = open(path.c_str(), O_RDONLY);
+		}
+
+		~LineReader(void) {
+			if(m_fd >= 0)
+				close(m_fd);
+		}
+
+		LineReader(const LineReader &) = delete;
+		LineReader &operator=(const LineReader &) = delete;
+
+		bool ok(void) const { return m_fd >= 0 && !m_error; }
+
+		// Move the next lines into text, stopping after max_rows rows or
+		// once max_bytes and at least one row are taken, whichever comes
+		// first. A last line without a '\n' still counts. Blank lines go
+		// into text but are not rows, as csv::Parse drops them at the end
+		// of a file, so no rows means only blank lines were left. Returns
+		// the number of rows.
+		size_t Take(size_t max_rows, size_t max_bytes, std::string &text) {
+			size_t rows = 0;
+			size_t scan = m_pos;
+			while(rows < max_rows && (rows == 0 || scan - m_pos < max_bytes)) {
+				const char *base = m_buffer.data();
+				const char *nl = static_cast<const char *>(memchr(base + scan, '\n', m_buffer.size() - scan));
+				if(nl != nullptr) {
+					if(!IsBlankLine(base + scan, nl))
+						rows++;
+					scan = nl - base + 1;
+					continue;
+				}
+				if(m_eof) {
+					if(!IsBlankLine(base + scan, base + m_buffer.size()))
+						rows++;
+					scan = m_buffer.size();
+					break;
+				}
+				m_buffer.erase(0, m_pos);
+				scan -= m_pos;
+				m_pos = 0;
+				Fill();
+			}
+			text.assign(m_buffer, m_pos, scan - m_pos);
+			m_pos = scan;
+			return rows;
+		}
+
+	private:
+		static bool IsBlankLine(const char *begin, const char *end) {
+			return std::all_of(begin, end, csv::IsBlank);
+		}
+
+		void Fill(void) {
+			size_t used = m_buffer.size();
+			m_buffer.resize(used + kReadBytes);
+			ssize_t got;
+			do {
+				got = read(m_fd, &m_buffer[used], kReadBytes);
+			} while(got < 0 && errno == EINTR);
+			if(got < 0)
+				m_error = true;
+			if(got <= 0)
+				m_eof = true;
+			m_buffer.resize(used + std::max<ssize_t>(got, 0));
+		}
+
+		int m_fd = -1;
+		std::string m_buffer;
+		size_t m_pos = 0;
+		bool m_eof = false;
+		bool m_error = false;
+	};
+
+	// Rows [first_row, first_row + rows) of every input, and their result
+	template <typename T, typename Allocator>
+	struct Block {
+		size_t first_row = 0;
+		size_t rows = 0;
+		size_t cols = 0;
+		std::vector<std::string> text;		// Raw lines, one per input
+		std::vector<Matrix<T, Allocator>> inputs;
+		Matrix<T, Allocator> output;		// Shaped by the compute step
+
+		Block(size_t num_inputs, const Allocator &alloc) : text(num_inputs), output(alloc) {
+			for(size_t k = 0; k < num_inputs; k++)
+				inputs.emplace_back(alloc);
+		}
+	};
+
+	// Stream the CSV inputs through compute(block) into outfilename. Inputs
+	// with an empty name are skipped and leave their matrix empty. compute
+	// runs on one thread, in row order, and shapes block.output itself.
+	// rows and cols are the shape of the inputs.
+	template <typename T, typename Allocator, typename Compute>
+	bool Run(const std::vector<std::string> &infilenames, const std::string &outfilename,
+		 const Allocator &alloc, size_t &rows, size_t &cols, Compute compute) {
+		using BlockT = Block<T, Allocator>;
+
+		std::vector<std::string> paths;
+		std::vector<std::unique_ptr<LineReader>> readers;
+		for(auto &name : infilenames) {
+			paths.push_back(name.empty() ? "" : "../in/" + name);
+			if(name.empty()) {
+				readers.emplace_back();
+				continue;
+			}
+			std::cout << "Streaming data from '" << paths.back() << "'" << std::endl;
+			readers.emplace_back(new LineReader(paths.back()));
+			if(!readers.back()->ok()) {
+				std::cerr << "Failed to open '" << paths.back() << "'" << std::endl;
+				return false;
+			}
+		}
+
+		std::string outfilepath = "../out/" + outfilename;
+		std::cout << "Streaming data to '" << outfilepath << "'" << std::endl;
+		int fd = open(outfilepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0) {
+			std::cerr << "Failed to open '" << outfilepath << "'" << std::endl;
+			return false;
+		}
+
+		std::vector<std::unique_ptr<BlockT>> pool;
+		BoundedQueue<BlockT *> free_blocks(kDepth), parsed(kDepth), computed(kDepth);
+		for(size_t i = 0; i < kDepth; i++) {
+			pool.emplace_back(new BlockT(infilenames.size(), alloc));
+			free_blocks.push(pool.back().get());
+		}
+
+		std::atomic<bool> failed(false);
+		rows = 0;
+		cols = 0;
+
+		// The first input decides how many rows a block holds, every other
+		// input must have the same number of rows and columns
+		std::thread parser([&]() {
+			size_t first = infilenames.size();
+			for(size_t k = 0; k < infilenames.size() && first == infilenames.size(); k++) {
+				if(readers[k])
+					first = k;
+			}
+			BlockT *block;
+			while(!failed && free_blocks.pop(block)) {
+				size_t block_rows = readers[first]->Take(SIZE_MAX, kBlockBytes, block->text[first]);
+				bool last = block_rows == 0;
+				for(size_t k = 0; k < infilenames.size() && !failed; k++) {
+					if(!readers[k])
+						continue;
+					size_t k_rows = k == first ? block_rows :
+						readers[k]->Take(last ? 1 : block_rows, SIZE_MAX, block->text[k]);
+					if(!readers[k]->ok()) {
+						std::cerr << "Failed to read '" << paths[k] << "'" << std::endl;
+						failed = true;
+					} else if(k_rows != block_rows) {
+						std::cerr << "Input sizes differ: '" << paths[first] << "' and '" << paths[k]
+							  << "' end at different rows" << std::endl;
+						failed = true;
+					}
+				}
+				if(failed || last) {
+					free_blocks.push(block);
+					break;
+				}
+
+				PERF_ZONE("parse block");
+				block->first_row = rows;
+				for(size_t k = 0; k < infilenames.size() && !failed; k++) {
+					if(!readers[k])
+						continue;
+					auto &matrix = block->inputs[k];
+					const std::string &text = block->text[k];
+					size_t text_rows, text_cols;
+					bool ok = csv::Parse<T>(text.data(), text.size(), paths[k], text_rows, text_cols,
+						[&matrix](size_t r, size_t c) { matrix.resize(r, c); return matrix.data(); },
+						rows);
+					if(ok && cols == 0)
+						cols = text_cols;
+					if(ok && text_cols != cols) {
+						std::cerr << "'" << paths[k] << "' row " << rows << ": " << text_cols
+							  << " values, expected " << cols << std::endl;
+						ok = false;
+					}
+					if(!ok)
+						failed = true;
+					block->rows = text_rows;
+				}
+				block->cols = cols;
+				rows += block->rows;
+				if(failed) {
+					free_blocks.push(block);
+					break;
+				}
+				parsed.push(block);
+			}
+			parsed.close();
+		});
+
+		std::thread computer([&]() {
+			BlockT *block;
+			while(parsed.pop(block)) {
+				if(!failed) {
+					try {
+						compute(*block);
+					} catch(const std::exception &e) {
+						std::cerr << "Block at row " << block->first_row << " failed: " << e.what() << std::endl;
+						failed = true;
+					}
+				}
+				computed.push(block);
+			}
+			computed.close();
+		});
+
+		// A failed write stops the parser, but blocks keep circulating
+		// until it sees that, so no stage is left waiting
+		std::thread writer([&]() {
+			BlockT *block;
+			while(computed.pop(block)) {
+				PERF_ZONE("write block");
+				if(!failed && !csv::Format(fd, block->output.data(), block->output.rows(), block->output.cols())) {
+					std::cerr << "Failed to write '" << outfilepath << "'" << std::endl;
+					failed = true;
+				}
+				free_blocks.push(block);
+			}
+		});
+
+		parser.join();
+		computer.join();
+		writer.join();
+
+		if(close(fd) != 0 && !failed) {
+			std::cerr << "Failed to write '" << outfilepath << "'" << std::endl;
+			failed = true;
+		}
+		return !failed;
+	}
+} // namespace stream
+
+#endif // PIPELINE_HPP__
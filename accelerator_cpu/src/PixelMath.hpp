@@ -0,0 +1,123 @@
+#ifndef PIXEL_MATH_HPP__
+#define PIXEL_MATH_HPP__
+
+#include <cstdint>
+
+// Per-channel arithmetic on packed RGBA16 pixels, r << 48 | g << 32 | b << 16 | a.
+// Plain integer ops on the packed word carry from one channel into the next,
+// so everything here works on the four 16-bit lanes independently (SWAR) and
+// clamps instead of wrapping. Usable from both device kernels and host code.
+// Color ops leave the alpha lane of their first operand untouched.
+namespace px
+{
+  constexpr uint64_t kLaneHigh  = 0x8000800080008000ull;  // Top bit of every lane
+  constexpr uint64_t kLaneLow   = 0x7FFF7FFF7FFF7FFFull;  // All but the top bit
+  constexpr uint64_t kEvenLanes = 0x0000FFFF0000FFFFull;  // b and a, widened to 32 bits
+  constexpr uint64_t kAlpha     = 0x000000000000FFFFull;
+
+  constexpr uint32_t kGainOne   = 1u << 8;   // Gain 1.0 in Q8.8
+  constexpr uint32_t kWeightOne = 1u << 15;  // Weight 1.0 in Q15
+
+  // v in every color lane, 0 in alpha
+  static inline uint64_t SplatColor(uint16_t v) {
+    return (uint64_t)v << 48 | (uint64_t)v << 32 | (uint64_t)v << 16;
+  }
+
+  // Spread each lane's top bit over the whole lane
+  static inline uint64_t LaneMask(uint64_t top_bits) {
+    return (top_bits >> 15) * 0xFFFF;
+  }
+
+  static inline uint64_t KeepAlpha(uint64_t from, uint64_t color) {
+    return (color & ~kAlpha) | (from & kAlpha);
+  }
+
+  // x + y per lane, clamped at 0xFFFF
+  static inline uint64_t AddSat16(uint64_t x, uint64_t y) {
+    uint64_t sum   = ((x & kLaneLow) + (y & kLaneLow)) ^ ((x ^ y) & kLaneHigh);
+    uint64_t carry = ((x & y) | ((x | y) & ~sum)) & kLaneHigh;
+    return sum | LaneMask(carry);
+  }
+
+  // x - y per lane, clamped at 0
+  static inline uint64_t SubSat16(uint64_t x, uint64_t y) {
+    uint64_t diff   = ((x | kLaneHigh) - (y & kLaneLow)) ^ ((x ^ ~y) & kLaneHigh);
+    uint64_t borrow = ((~x & y) | (~(x ^ y) & diff)) & kLaneHigh;
+    return diff & ~LaneMask(borrow);
+  }
+
+  // |x - y| per lane
+  static inline uint64_t AbsDiff16(uint64_t x, uint64_t y) {
+    return SubSat16(x, y) | SubSat16(y, x);
+  }
+
+  // Two 32-bit lanes holding (x * gain + 128) >> 8, clamped to 0xFFFF.
+  // gain < 2^16 keeps each product inside its 32-bit lane.
+  static inline uint64_t ScaleWide(uint64_t wide, uint32_t gain) {
+    uint64_t v = ((wide * gain + ((uint64_t)128 << 32 | 128)) >> 8) & 0x00FFFFFF00FFFFFFull;
+    uint64_t over = ((((v >> 16) & kEvenLanes) + kEvenLanes) >> 16) & 0x0000000100000001ull;
+    return (v | over * 0xFFFF) & kEvenLanes;
+  }
+
+  // x * gain per lane, gain in Q8.8
+  static inline uint64_t Scale16(uint64_t x, uint32_t gain) {
+    return ScaleWide(x & kEvenLanes, gain) | ScaleWide((x >> 16) & kEvenLanes, gain) << 16;
+  }
+
+  // (x * weight + y * (1 - weight)) per lane, weight in Q15. Both products
+  // stay below 2^31, so the widened sum never crosses into the next lane.
+  static inline uint64_t Lerp16(uint64_t x, uint64_t y, uint32_t weight) {
+    const uint64_t round = (uint64_t)(1 << 14) << 32 | (1 << 14);
+    uint32_t inv = kWeightOne - weight;
+    uint64_t even = ((x & kEvenLanes) * weight + (y & kEvenLanes) * inv + round) >> 15;
+    uint64_t odd  = (((x >> 16) & kEvenLanes) * weight + ((y >> 16) & kEvenLanes) * inv + round) >> 15;
+    return (even & kEvenLanes) | (odd & kEvenLanes) << 16;
+  }
+
+  // Per-pixel operations used by the image commands
+
+  // Scale by gain then add offset, both clamped
+  struct Brighten {
+    static constexpr const char *kName = "brighten";
+    uint32_t gain;        // Q8.8, below 2^16
+    uint64_t offset_add;  // SplatColor of a positive offset
+    uint64_t offset_sub;  // SplatColor of a negative offset's magnitude
+
+    uint64_t operator()(uint64_t p) const {
+      return KeepAlpha(p, AddSat16(SubSat16(Scale16(p, gain), offset_sub), offset_add));
+    }
+  };
+
+  static inline Brighten MakeBrighten(int gain_percent, int offset) {
+    uint32_t gain = gain_percent <= 0 ? 0 : (uint32_t)gain_percent * kGainOne / 100;
+    uint16_t magnitude = offset < 0 ? (offset < -0xFFFF ? 0xFFFF : -offset)
+                                    : (offset > 0xFFFF ? 0xFFFF : offset);
+    return Brighten{gain > 0xFFFF ? 0xFFFF : gain,
+                    offset > 0 ? SplatColor(magnitude) : 0,
+                    offset < 0 ? SplatColor(magnitude) : 0};
+  }
+
+  // weight * a + (1 - weight) * b
+  struct Blend {
+    static constexpr const char *kName = "blend";
+    uint32_t weight;  // Q15, at most kWeightOne
+
+    uint64_t operator()(uint64_t a, uint64_t b) const {
+      return KeepAlpha(a, Lerp16(a, b, weight));
+    }
+  };
+
+  static inline Blend MakeBlend(int weight_percent) {
+    int clamped = weight_percent < 0 ? 0 : (weight_percent > 100 ? 100 : weight_percent);
+    return Blend{(uint32_t)clamped * kWeightOne / 100};
+  }
+
+  // |a - b|
+  struct Diff {
+    static constexpr const char *kName = "diff";
+    uint64_t operator()(uint64_t a, uint64_t b) const {
+      return KeepAlpha(a, AbsDiff16(a, b));
+    }
+  };
+} // namespace px
+#endif // PIXEL_MATH_HPP__
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <string>
 #include <filesystem>
+#include <functional>
 #include <png.h>
 #include <assert.h>
 
@@ -3,9 +3,31 @@
 // oneAPI headers
 #include <sycl/ext/intel/fpga_extensions.hpp>
 #include <sycl/sycl.hpp>
-#include "exception_handler.hpp"
-#include "fast-cpp-csv-parser/csv.h"
-#include "LoopbackTest.hpp"
+#include "Expression.hpp"
+#include "io.hpp"
+#include "Pipeline.hpp"
+#include "Trace.hpp"
+#include "PerfAlloc.hpp"
+#include "Verify.hpp"
+
+using namespace sycl;
+
+// Terminate on asynchronous SYCL exceptions, reporting what they were
+static auto exception_handler = [](sycl::exception_list e_list)
+{
+	for (std::exception_ptr const &e : e_list)
+	{
+		try
+		{
+			std::rethrow_exception(e);
+		}
+		catch (std::exception const &e)
+		{
+			std::cerr << "Caught asynchronous SYCL exception: " << e.what() << std::endl;
+			std::terminate();
+		}
+	}
+};
 
 // The type that will stream through the IO pipe. When using real IO pipes,
 // make sure the width of this datatype matches the width of the IO pipe, which
@@ -13,8 +35,9 @@
 using IOPipeType = int;
 
 // Forward declare the kernel name in the global scope. This is an FPGA best
-// practice that reduces name mangling in the optimization reports.
-class AcceleratorID;
+// practice that reduces name mangling in the optimization reports. Each
+// functor gets its own name, AcceleratorID<VectorAdd> and so on.
+template <typename Kernel> class AcceleratorID;
 
 // Determine if help message needs to print
 bool help = false;
@@ -34,99 +57,153 @@ constexpr bool kUseUSMHostAllocation = false;
 #endif
 */
 
-////////////////////////////////////////////////////////////////////////////////
-// File I/O
-bool ReadInputData(std::string infilename, std::vector<std::vector<int>> &indata);
-bool WriteOutputData(std::string outfilename, std::vector<std::vector<int>> &outdata);
-////////////////////////////////////////////////////////////////////////////////
+// All kernels work on a whole row-major matrix in one launch. Row r of a
+// matrix with cols columns starts at offset r * cols, taken in size_t: a
+// matrix may hold more than INT_MAX elements even when its sides fit an int.
 
+// Elements the elementwise kernels process per loop iteration. The inner
+// loop is unrolled into this many parallel lanes.
+constexpr int kLanes = 16;
+
+// Memory of the S10 PAC, the peak -p compares kernel bandwidth to
+constexpr int kNumMemChannels = 4;
+constexpr double kMemChannelGBps = 19.2;	// DDR4-2400, 64 bits wide
+
+template <typename T>
 struct VectorFlip
 {
-	int *const a_in;
-	int *const b_out;
-	int len;
+	T *const a_in;
+	T *const b_out;
+	int rows;
+	int cols;
 
 	void operator()() const
 	{
-		int a_idx;
-		for (int b_idx = 0; b_idx < len; b_idx++)
+		for (int row = 0; row < rows; row++)
 		{
-			a_idx = len - b_idx - 1;
-			int a_val = a_in[a_idx];
-			b_out[b_idx] = a_val;
+			size_t offset = (size_t)row * cols;
+			int a_idx;
+			for (int b_idx = 0; b_idx < cols; b_idx++)
+			{
+				a_idx = cols - b_idx - 1;
+				T a_val = a_in[offset + a_idx];
+				b_out[offset + b_idx] = a_val;
+			}
 		}
 	}
 };
 
+template <typename T>
 struct VectorAdd
 {
-	int *const a_in;
-	int *const b_in;
-	int *const c_out;
-	int len;
+	T *const a_in;
+	T *const b_in;
+	T *const c_out;
+	size_t len;
 
 	void operator()() const
 	{
-		for (int idx = 0; idx < len; idx++)
+		for (size_t base = 0; base < len; base += kLanes)
 		{
-			int a_val = a_in[idx];
-			int b_val = b_in[idx];
-			int sum = a_val + b_val;
-			c_out[idx] = sum;
+			#pragma unroll
+			for (int lane = 0; lane < kLanes; lane++)
+			{
+				size_t idx = base + lane;
+				if (idx < len)
+				{
+					T a_val = a_in[idx];
+					T b_val = b_in[idx];
+					T sum = expr::Plus::apply(a_val, b_val);
+					c_out[idx] = sum;
+				}
+			}
 		}
 	}
 };
 
+template <typename T>
 struct VectorSubtract
 {
-	int *const a_in;
-	int *const b_in;
-	int *const c_out;
-	int len;
+	T *const a_in;
+	T *const b_in;
+	T *const c_out;
+	size_t len;
 
 	void operator()() const
 	{
-		for (int idx = 0; idx < len; idx++)
+		for (size_t base = 0; base < len; base += kLanes)
 		{
-			int a_val = a_in[idx];
-			int b_val = b_in[idx];
-			int sum = a_val - b_val;
-			c_out[idx] = sum;
+			#pragma unroll
+			for (int lane = 0; lane < kLanes; lane++)
+			{
+				size_t idx = base + lane;
+				if (idx < len)
+				{
+					T a_val = a_in[idx];
+					T b_val = b_in[idx];
+					T sum = expr::Minus::apply(a_val, b_val);
+					c_out[idx] = sum;
+				}
+			}
 		}
 	}
 };
 
+template <typename T>
 struct VectorMultiply
 {
-	int *const a_in;
-	int *const b_in;
-	int *const c_out;
-	int len;
+	T *const a_in;
+	T *const b_in;
+	T *const c_out;
+	size_t len;
 
 	void operator()() const
 	{
-		for (int idx = 0; idx < len; idx++)
+		for (size_t base = 0; base < len; base += kLanes)
 		{
-			int a_val = a_in[idx];
-			int b_val = b_in[idx];
-			int sum = a_val * b_val;
-			c_out[idx] = sum;
+			#pragma unroll
+			for (int lane = 0; lane < kLanes; lane++)
+			{
+				size_t idx = base + lane;
+				if (idx < len)
+				{
+					T a_val = a_in[idx];
+					T b_val = b_in[idx];
+					T sum = expr::Times::apply(a_val, b_val);
+					c_out[idx] = sum;
+				}
+			}
 		}
 	}
 };
 
+// Keep the top left out_rows x out_cols corner of a matrix with in_cols columns
+template <typename T>
 struct VectorCrop
 {
-	int *const a_in;
-	int *const b_out;
-	int len;
+	T *const a_in;
+	T *const b_out;
+	int in_cols;
+	int out_rows;
+	int out_cols;
 
 	void operator()() const
 	{
-		for (int idx = 0; idx < len; idx++)
+		for (int row = 0; row < out_rows; row++)
 		{
-			int val = a_in[idx];
-			b_out[idx] = val;
+			for (int base = 0; base < out_cols; base += kLanes)
+			{
+				#pragma unroll
+				for (int lane = 0; lane < kLanes; lane++)
+				{
+					int idx = base + lane;
+					if (idx < out_cols)
+					{
+						T val = a_in[((size_t)row * in_cols) + idx];
+						b_out[((size_t)row * out_cols) + idx] = val;
+					}
+				}
+			}
 		}
 	}
 };
@@ -137,14 +214,40 @@ void Help(void)
 	// Command line arguments.
 	// accelerator [command] -i=[input file] -o=[output file]
 	// -h, --help
+	// -p, --perf
 
-	// future options?
-	// -p,performance : output perf metrics
-
-	std::cout << "accelerator [command] -i=<input file> -o=<output file>\n";
+	std::cout << "accelerator [command] -i=<input file> [-i2=<input file>] -o=<output file>\n";
+	std::cout << "accelerator --expr=<expression> -i=<a> [-i2=<b> -i3=<c> -i4=<d>] -o=<output file>\n";
 	std::cout << "  -h,--help                                : this help text\n";
+	std::cout << "  -p,--perf                                : print the time spent in each stage\n";
+	std::cout << "  --verify                                 : check the result against a host reference\n";
+	std::cout << "  --mem                                    : -p plus the allocations and resident memory\n";
+	std::cout << "                                             of each stage\n";
+	std::cout << "  --counters                               : -p plus cycles, IPC and cache, dTLB and branch\n";
+	std::cout << "                                             misses of each stage (perf_event_open)\n";
+	std::cout << "  --peak-gbps=<n>                          : memory bandwidth -p compares kernels to\n";
+	std::cout << "                                             (default: 4 DDR4-2400 channels)\n";
+	std::cout << "  --trace=<file>                           : write host stages and kernels as a Chrome\n";
+	std::cout << "                                             trace, for Perfetto\n";
+	std::cout << "  Files ending in .npy are read and written as NumPy arrays, anything else\n";
+	std::cout << "  as CSV. int32, int64, uint16 and float32 arrays are converted to --type\n";
+	std::cout << "  -i2=<input file>                         : second operand of add, sub, mul\n";
+	std::cout << "  -i3=<input file> -i4=<input file>        : inputs c and d of an expression\n";
+	std::cout << "  -rows=<n> -cols=<n>                      : size of the crop\n";
+	std::cout << "  --type=<int|float>                       : element type of the matrices, int by default\n";
+	std::cout << "  --stream                                 : parse, compute and write CSV a block of rows\n";
+	std::cout << "                                             at a time, in constant memory\n";
+	std::cout << "  --expr=<expression>                      : evaluate e.g. \"(a+b)*c\" in one pass\n";
+	std::cout << "                                             over inputs a-d, integers, + - * ()\n";
+	std::cout << "  --interpret                              : run --expr on the stack interpreter kernel\n";
+	std::cout << "                                             even if it fits a fused one\n";
 	std::cout << "  [command]                                                \n";
 	std::cout << "  	flip                             : flip vectors  \n";
+	std::cout << "  	add                              : a + b elementwise\n";
+	std::cout << "  	sub                              : a - b elementwise\n";
+	std::cout << "  	mul                              : a * b elementwise\n";
+	std::cout << "  	crop                             : top left rows x cols of a\n";
+	std::cout << "  	expr                             : evaluate --expr (the default with --expr)\n";
 }
 
 bool FindGetArg(std::string &arg, const char *str, int defaultval, int *val)
@@ -165,7 +268,7 @@ bool FindGetArgString(std::string &arg, const char *str, char *str_value, size_t
 	if (found != std::string::npos)
 	{
 		const char *sptr = &arg.c_str()[strlen(str)];
-		for (int i = 0; i < maxchars - 1; i++)
+		for (size_t i = 0; i + 1 < maxchars; i++)
 		{
 			char ch = sptr[i];
 			switch (ch)
@@ -186,15 +289,334 @@ bool FindGetArgString(std::string &arg, const char *str, char *str_value, size_t
 	return false;
 }
 
+// Everything a run needs from the command line
+struct Job
+{
+	std::string command;
+	std::string expression;
+	expr::ProgramExpr program;
+	expr::Tree tree;
+	bool fused;			// Evaluate the tree as an expression template, not the program
+	int operands;			// Bit k is set if the command reads input k
+	const std::string *infilenames;	// expr::kMaxInputs names, input k is operand 'a' + k
+	std::string outfilename;
+	int crop_rows;
+	int crop_cols;
+	bool verify;			// Check the result against the host (--verify)
+};
+
+// Print what the command is about to do
+void Announce(const Job &job)
+{
+	if (job.command.compare("flip") == 0)
+		std::cout << "Performing vector flip\n";
+	else if (job.command.compare("add") == 0)
+		std::cout << "Performing vector add\n";
+	else if (job.command.compare("sub") == 0)
+		std::cout << "Performing vector subtract\n";
+	else if (job.command.compare("mul") == 0)
+		std::cout << "Performing vector multiply\n";
+	else if (job.command.compare("crop") == 0)
+		std::cout << "Performing vector crop\n";
+	else if (job.command.compare("expr") == 0)
+		std::cout << "Evaluating " << job.expression << " in one pass, "
+			  << (job.fused ? "fused" : "interpreted") << "\n";
+}
+
+// Run the command's kernel on rows x cols inputs in[], writing the
+// out_rows x out_cols result to b
+template <typename T>
+void Launch(sycl::queue &q, const Job &job, T *const in[], T *b, int rows, int cols, int out_rows, int out_cols)
+{
+	// Every kernel reads each element it uses from each input once and
+	// writes each result once; a crop only reads the part it keeps
+	uint64_t read = job.command.compare("crop") == 0 ? (uint64_t)out_rows * out_cols : (uint64_t)rows * cols;
+	uint64_t bytes = (uint64_t)out_rows * out_cols * sizeof(T);
+	for (int k = 0; k < expr::kMaxInputs; k++)
+	{
+		if (job.operands & (1 << k))
+			bytes += read * sizeof(T);
+	}
+	perf::ScopedZone kernel("kernel", bytes);
+	T *a = in[0];
+	T *a2 = in[1];
+	sycl::event e;
+
+	if (job.command.compare("flip") == 0)
+	{
+		e = q.single_task<AcceleratorID<VectorFlip<T>>> (VectorFlip<T>{a, b, rows, cols});
+	}
+	else if (job.command.compare("add") == 0)
+	{
+		e = q.single_task<AcceleratorID<VectorAdd<T>>> (VectorAdd<T>{a, a2, b, (size_t)rows * cols});
+	}
+	else if (job.command.compare("sub") == 0)
+	{
+		e = q.single_task<AcceleratorID<VectorSubtract<T>>> (VectorSubtract<T>{a, a2, b, (size_t)rows * cols});
+	}
+	else if (job.command.compare("mul") == 0)
+	{
+		e = q.single_task<AcceleratorID<VectorMultiply<T>>> (VectorMultiply<T>{a, a2, b, (size_t)rows * cols});
+	}
+	else if (job.command.compare("crop") == 0)
+	{
+		e = q.single_task<AcceleratorID<VectorCrop<T>>> (VectorCrop<T>{a, b, cols, out_rows, out_cols});
+	}
+	else if (job.command.compare("expr") == 0)
+	{
+		// Expressions are integer only, main turns away other types
+		if constexpr (std::is_same<T, int>::value)
+		{
+			// One kernel loads each input the expression uses once and
+			// writes the result once, however many operators it has. Short
+			// expressions run a kernel built for their shape; the rest
+			// interpret the expression's program per element.
+			if (job.fused)
+			{
+				expr::Instantiate<expr::kMaxFusedHeight>(job.tree, job.tree.root, in, [&](auto expression)
+				{
+					using Evaluate = expr::VectorEvaluate<decltype(expression), kLanes>;
+					e = q.single_task<AcceleratorID<Evaluate>> (Evaluate{expression, b, (size_t)rows * cols});
+				});
+			}
+			else
+			{
+				using Evaluate = expr::VectorEvaluate<expr::ProgramExpr, kLanes>;
+				expr::ProgramExpr program = job.program;
+				for (int k = 0; k < expr::kMaxInputs; k++)
+					program.inputs[k] = in[k];
+				e = q.single_task<AcceleratorID<Evaluate>> (Evaluate{program, b, (size_t)rows * cols});
+			}
+		}
+	}
+	perf::TraceEvent(e, "fpga queue", job.command, bytes);
+	e.wait();
+}
+
+// --verify: the out_rows x out_cols result b against a host reference of
+// the command over rows x cols inputs in[]. first_row is where in[] starts
+// in the whole matrix, for the report.
+template <typename T>
+bool VerifyOutput(const Job &job, T *const in[], const T *b, int rows, int cols, int out_rows, int out_cols,
+		  size_t first_row = 0)
+{
+	PERF_ZONE("verify");
+	const std::string &command = job.command;
+	expr::ProgramExpr program = job.program;
+	if constexpr (std::is_same<T, int>::value)
+	{
+		for (int k = 0; k < expr::kMaxInputs; k++)
+			program.inputs[k] = in[k];
+	}
+	verify::Result<T> result = verify::Check(b, out_cols, out_rows, [&](size_t first, size_t n, T *out)
+	{
+		for (size_t row = first; row < first + n; row++)
+		{
+			const T *a = in[0] + row * cols;
+			const T *a2 = in[1] == nullptr ? nullptr : in[1] + row * cols;
+			T *o = out + (row - first) * out_cols;
+			for (int col = 0; col < out_cols; col++)
+			{
+				if (command.compare("flip") == 0)
+					o[col] = a[cols - 1 - col];
+				else if (command.compare("add") == 0)
+					o[col] = a[col] + a2[col];
+				else if (command.compare("sub") == 0)
+					o[col] = a[col] - a2[col];
+				else if (command.compare("mul") == 0)
+					o[col] = a[col] * a2[col];
+				else if (command.compare("crop") == 0)
+					o[col] = a[col];
+				else if constexpr (std::is_same<T, int>::value)
+					o[col] = program(row * cols + col);
+			}
+		}
+	});
+	if (!result.ok)
+	{
+		std::cerr << "Verification failed, first difference at row " << first_row + result.row << ", column "
+			  << result.col << ": expected " << result.expected << ", got " << result.actual << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Read the inputs, run the command and write the result, with T elements
+template <typename T>
+bool Run(sycl::queue &q, const Job &job)
+{
+	using SharedMatrix = Matrix<T, SharedAllocator<T>>;
+	SharedAllocator<T> alloc(q);
+	bool passed = true;
+
+	// Each matrix lives in one shared allocation so every command is a
+	// single launch with a single sync point
+	int rows = -1, cols = -1;
+	std::vector<SharedMatrix> inputs;
+	T *in[expr::kMaxInputs] = {nullptr};
+	for (int k = 0; k < expr::kMaxInputs; k++)
+	{
+		inputs.emplace_back(alloc);
+		if (!(job.operands & (1 << k)))
+			continue;
+
+		// Parsed (CSV) or copied (.npy) straight into shared memory
+		perf::ScopedZone read("read input");
+		passed &= ReadInputData(job.infilenames[k], inputs[k]);
+		read.End();
+		if (!passed)
+			std::terminate();
+		in[k] = inputs[k].data();
+		if (rows < 0)
+		{
+			rows = inputs[k].rows();
+			cols = inputs[k].cols();
+		}
+		else if ((int)inputs[k].rows() != rows || (int)inputs[k].cols() != cols)
+		{
+			std::cerr << "Input sizes differ: " << rows << "x" << cols
+				  << " and " << inputs[k].rows() << "x" << inputs[k].cols() << std::endl;
+			std::terminate();
+		}
+	}
+	std::cout << "Finished reading data\n";
+	perf::SetItems((uint64_t)rows * cols, "elem");
+
+	int out_rows = rows;
+	int out_cols = cols;
+	if (job.command.compare("crop") == 0)
+	{
+		if (job.crop_rows <= 0 || job.crop_rows > rows || job.crop_cols <= 0 || job.crop_cols > cols)
+		{
+			std::cerr << "Crop of " << job.crop_rows << "x" << job.crop_cols << " does not fit in "
+				  << rows << "x" << cols << ", set -rows= and -cols=" << std::endl;
+			std::terminate();
+		}
+		out_rows = job.crop_rows;
+		out_cols = job.crop_cols;
+	}
+
+	SharedMatrix out(alloc);
+	try
+	{
+		out.resize(out_rows, out_cols);
+	}
+	catch (std::bad_alloc const &)
+	{
+		std::cerr << "Shared memory allocation failure\n";
+		std::terminate();
+	}
+	T *b = out.data();
+
+	Announce(job);
+	Launch(q, job, in, b, rows, cols, out_rows, out_cols);
+	if (job.verify)
+	{
+		passed &= VerifyOutput(job, in, b, rows, cols, out_rows, out_cols);
+		if (passed)
+			std::cout << "Verified " << out_rows << "x" << out_cols << " output against the host reference\n";
+	}
+
+	// The result is formatted straight out of the shared allocation
+	perf::ScopedZone write("write output");
+	passed &= WriteOutputData(job.outfilename, out);
+	write.End();
+	if (!passed)
+		std::terminate();
+	return passed;
+}
+
+// Like Run, but the inputs stream through the kernel a block of rows at a
+// time, so memory does not grow with the file. CSV only.
+template <typename T>
+bool RunStream(sycl::queue &q, const Job &job)
+{
+	using Block = stream::Block<T, SharedAllocator<T>>;
+	SharedAllocator<T> alloc(q);
+
+	std::vector<std::string> names;
+	for (int k = 0; k < expr::kMaxInputs; k++)
+		names.push_back((job.operands & (1 << k)) ? job.infilenames[k] : std::string());
+
+	bool crop = job.command.compare("crop") == 0;
+	Announce(job);
+	size_t rows, cols;
+	// Each block is checked as it comes off the kernel; after the first
+	// failure the rest are not
+	bool verified = true;
+	// The stages run on the pipeline's own threads, in parallel, so their
+	// rows of the --perf table can add up to more than this zone
+	perf::ScopedZone streaming("stream");
+	bool passed = stream::Run<T>(names, job.outfilename, alloc, rows, cols,
+		[&](Block &block)
+		{
+			T *in[expr::kMaxInputs] = {nullptr};
+			for (int k = 0; k < expr::kMaxInputs; k++)
+			{
+				if (job.operands & (1 << k))
+					in[k] = block.inputs[k].data();
+			}
+			int block_rows = block.rows;
+			int out_rows = block_rows;
+			int out_cols = block.cols;
+			if (crop)
+			{
+				if (job.crop_cols <= 0 || job.crop_cols > (int)block.cols)
+					throw std::runtime_error("crop of " + std::to_string(job.crop_cols) + " columns does not fit in " +
+								 std::to_string(block.cols) + ", set -cols=");
+				long left = (long)job.crop_rows - (long)block.first_row;
+				out_rows = (int)std::max(0L, std::min<long>(left, block_rows));
+				out_cols = job.crop_cols;
+			}
+			block.output.resize(out_rows, out_cols);
+			if (out_rows > 0)
+			{
+				Launch(q, job, in, block.output.data(), block_rows, block.cols, out_rows, out_cols);
+				if (job.verify && verified)
+					verified = VerifyOutput(job, in, block.output.data(), block_rows, block.cols, out_rows, out_cols,
+								block.first_row);
+			}
+		});
+	streaming.End();
+
+	if (passed && crop && (job.crop_rows <= 0 || (size_t)job.crop_rows > rows))
+	{
+		std::cerr << "Crop of " << job.crop_rows << "x" << job.crop_cols << " does not fit in "
+			  << rows << "x" << cols << ", set -rows= and -cols=" << std::endl;
+		passed = false;
+	}
+	perf::SetItems((uint64_t)rows * cols, "elem");
+	if (passed)
+		std::cout << "Streamed " << rows << "x" << cols << "\n";
+	if (job.verify && verified)
+		std::cout << "Verified every block against the host reference\n";
+	passed &= verified;
+	return passed;
+}
+
 int main(int argc, char *argv[])
 {
 	char out_file_str_buffer[kMaxStringLen] = {0};
 	char in_file_str_buffer[kMaxStringLen] = {0};
-	std::vector<std::vector<int>> outdata;
-	std::vector<std::vector<int>> indata;
+	char in2_file_str_buffer[kMaxStringLen] = {0};
+	char in3_file_str_buffer[kMaxStringLen] = {0};
+	char in4_file_str_buffer[kMaxStringLen] = {0};
+	char type_str_buffer[kMaxStringLen] = "int";
+	char trace_str_buffer[kMaxStringLen] = {0};
+	char peak_str_buffer[kMaxStringLen] = {0};
 	std::string outfilename = "";
-	std::string infilename = "";
+	int crop_rows = 0;
+	int crop_cols = 0;
 	std::string command = "";
+	std::string expression = "";
+	bool streaming = false;
+	bool perf_report = false;
+	bool mem_report = false;
+	bool counter_report = false;
+	bool verify_output = false;
+	bool interpret = false;
+	expr::ProgramExpr program{};
+	expr::Tree tree{};
 /*
 #if defined(FPGA_EMULATOR)
 	size_t count = 1 << 12;
@@ -207,11 +629,12 @@ int main(int argc, char *argv[])
 	bool passed = true;
 
 	// Check the number of arguments specified
-	if (argc != 4)
+	if (argc < 4)
 	{
 		std::cerr << "Incorrect number of arguments. Correct usage: "
 			  << argv[0]
-			  << " [command] -i=<input-file> -o=<output-file>"
+			  << " [command] -i=<input-file> [-i2=<input-file>] -o=<output-file>"
+			  << " or " << argv[0] << " --expr=<expression> -i=<input-file> ... -o=<output-file>"
 			  << std::endl;
 		return 1;
 	}
@@ -236,6 +659,38 @@ int main(int argc, char *argv[])
 			FindGetArgString(sarg, "-o=", out_file_str_buffer, kMaxStringLen);
 			FindGetArgString(sarg, "-out=", out_file_str_buffer, kMaxStringLen);
 			FindGetArgString(sarg, "--output-file=", out_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "-i2=", in2_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "--input-file2=", in2_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "-i3=", in3_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "--input-file3=", in3_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "-i4=", in4_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "--input-file4=", in4_file_str_buffer, kMaxStringLen);
+			// The expression may contain spaces, so take the whole argument
+			if (sarg.rfind("--expr=", 0) == 0)
+				expression = sarg.substr(strlen("--expr="));
+			FindGetArgString(sarg, "--type=", type_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "--trace=", trace_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "--peak-gbps=", peak_str_buffer, kMaxStringLen);
+			if (sarg == "--stream")
+				streaming = true;
+			if (sarg == "-p" || sarg == "--perf")
+				perf_report = true;
+			if (sarg == "--mem")
+			{
+				perf_report = true;
+				mem_report = true;
+			}
+			if (sarg == "--counters")
+			{
+				perf_report = true;
+				counter_report = true;
+			}
+			if (sarg == "--verify")
+				verify_output = true;
+			if (sarg == "--interpret")
+				interpret = true;
+			FindGetArg(sarg, "-rows=", 0, &crop_rows);
+			FindGetArg(sarg, "-cols=", 0, &crop_cols);
 		} 
 		else
 		{
@@ -249,12 +704,92 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	infilename = std::string(in_file_str_buffer);
+	if (!expression.empty() && command.empty())
+		command = "expr";
+
+	// Input i is operand 'a' + i of an expression
+	std::string infilenames[expr::kMaxInputs] = {
+		std::string(in_file_str_buffer), std::string(in2_file_str_buffer),
+		std::string(in3_file_str_buffer), std::string(in4_file_str_buffer)};
+	const char *input_flags[expr::kMaxInputs] = {"-i", "-i2", "-i3", "-i4"};
 	outfilename = std::string(out_file_str_buffer);
-	std::cout << "Command: " << command
-		  << ", input file: " << infilename
-		  << ", output file: " << outfilename
-		  << std::endl;
+	std::string element_type(type_str_buffer);
+	std::string tracefilename(trace_str_buffer);
+
+	if (element_type != "int" && element_type != "float")
+	{
+		std::cerr << "Unknown element type '" << element_type << "', use --type=int or --type=float" << std::endl;
+		return 1;
+	}
+	if (streaming && IsNpyFile(outfilename))
+	{
+		std::cerr << "--stream writes CSV only" << std::endl;
+		return 1;
+	}
+
+	// Bit i is set if the command reads input i
+	int operands = 0;
+	if (command == "flip" || command == "crop")
+		operands = 0x1;
+	else if (command == "add" || command == "sub" || command == "mul")
+		operands = 0x3;
+	else if (command == "expr")
+	{
+		try
+		{
+			expr::Parser parser(expression);
+			program = parser.parse();
+			tree = parser.tree();
+			operands = parser.inputsUsed();
+		}
+		catch (std::exception const &e)
+		{
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		if (operands == 0)
+		{
+			std::cerr << "Expression '" << expression << "' reads no inputs" << std::endl;
+			return 1;
+		}
+		if (element_type != "int")
+		{
+			std::cerr << "Expressions work on int matrices, drop --type=" << element_type << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		std::cerr << "Unknown command '" << command << "'" << std::endl;
+		Help();
+		return 1;
+	}
+
+	std::cout << "Command: " << command;
+	if (command == "expr")
+		std::cout << " " << expression;
+	for (int k = 0; k < expr::kMaxInputs; k++)
+	{
+		if (!(operands & (1 << k)))
+			continue;
+		if (infilenames[k].empty())
+		{
+			std::cerr << "\nCommand '" << command << "' needs input " << char('a' + k)
+				  << ", " << input_flags[k] << "=<input-file>" << std::endl;
+			return 1;
+		}
+		if (streaming && IsNpyFile(infilenames[k]))
+		{
+			std::cerr << "\n--stream reads CSV only" << std::endl;
+			return 1;
+		}
+		std::cout << ", input " << char('a' + k) << ": " << infilenames[k];
+	}
+	std::cout << ", output file: " << outfilename
+		  << ", elements: " << element_type << std::endl;
+
+	bool fused = command == "expr" && !interpret && tree.height <= expr::kMaxFusedHeight;
+	Job job{command, expression, program, tree, fused, operands, infilenames, outfilename, crop_rows, crop_cols, verify_output};
 
 	try {
 		// Use compile-time macros to select either:
@@ -272,8 +807,37 @@ int main(int argc, char *argv[])
 		// queue properties to enable SYCL profiling of kernels
 		auto prop_list = property_list{property::queue::enable_profiling()};
 
+		if (perf_report)
+		{
+			// Peak of the board's DDR, or of the host memory the emulator
+			// runs in
+			if (peak_str_buffer[0] != 0)
+				perf::SetPeak(atof(peak_str_buffer), "--peak-gbps");
+			else
+			{
+#if FPGA_HARDWARE
+				perf::SetPeak(kNumMemChannels * kMemChannelGBps,
+					      "S10 PAC, " + std::to_string(kNumMemChannels) + " DDR4-2400 channels");
+#else
+				perf::SetPeak(perf::MeasureStreamCopy(), "host STREAM copy");
+#endif
+			}
+			// The kernels are traced too, for their device time
+			perf::EnableTrace();
+		}
+		if (!tracefilename.empty())
+			perf::EnableTrace();
+		if (mem_report)
+			perf::EnableMemory();
+		// Before the queue and the pipeline, their threads inherit the
+		// counters
+		if (counter_report)
+			perf::EnableCounters();
+
 		// create the device queue
-		queue q(selector, fpga_tools::exception_handler, prop_list);
+		perf::ScopedZone creation("queue creation");
+		queue q(selector, exception_handler, prop_list);
+		creation.End();
 
 		auto device = q.get_device();
 
@@ -294,47 +858,36 @@ int main(int argc, char *argv[])
 
 		auto start_time = std::chrono::high_resolution_clock::now();
 
-		passed &= ReadInputData(infilename, indata);
-		if (!passed)
-			std::terminate();
+		if (streaming && element_type == "float")
+			passed &= RunStream<float>(q, job);
+		else if (streaming)
+			passed &= RunStream<int>(q, job);
+		else if (element_type == "float")
+			passed &= Run<float>(q, job);
+		else
+			passed &= Run<int>(q, job);
 
-		std::cout << "Finished reading data\n";
+		auto end_time = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double, std::milli> process_time(end_time - start_time);
+    		std::cout << "Program took " << process_time.count() << " milliseconds\n";
 
-		if (command.compare("flip") == 0)
+		if (perf_report)
 		{
-			std::cout << "Performing vector flip\n";
-			int kVectSize;
-			for (auto &row: indata)
+			perf::PrintReport();
+			perf::PrintDeviceReport();
+			perf::PrintMemoryReport();
+			perf::PrintCounterReport();
+		}
+		if (!tracefilename.empty())
+		{
+			if (perf::WriteTrace(tracefilename))
+				std::cout << "Trace written to '" << tracefilename << "'\n";
+			else
 			{
-				std::vector<int> v;
-
-				kVectSize = row.size();
-				int *a = sycl::malloc_shared<int>(kVectSize, q);
-				int *b = sycl::malloc_shared<int>(kVectSize, q);
-
-				for (int i = 0; i < kVectSize; i++)
-				{
-					a[i] = row[i];
-				}
-
-				q.single_task<AcceleratorID> (VectorFlip{a, b, kVectSize}).wait();
-
-				for (int i = 0; i < kVectSize; i++)
-					v.push_back(b[i]);
-				outdata.push_back(v);
-
-				free(a, q);
-				free(b, q);
+				std::cerr << "Failed to write '" << tracefilename << "'" << std::endl;
+				passed = false;
 			}
 		}
-		
-		passed &= WriteOutputData(outfilename, outdata);
-		if (!passed)
-			std::terminate();
-
-		auto end_time = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double, std::milli> process_time(end_time - start_time);
-    		std::cout << "Program took " << process_time.count() << " milliseconds\n";
 
 //		passed &= RunLoopbackSystem<IOPipeType, kUseUSMHostAllocation>(q, count);
 
@@ -396,68 +949,3 @@ int main(int argc, char *argv[])
 	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
 	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-
-bool ReadInputData(std::string infilename, std::vector<std::vector<int>> &indata)
-{
-	std::string infilepath = "../in/" + infilename;
-	std::string line, val;
-
-	std::cout << "Reading data from '" << infilepath << "'" << std::endl;
-
-	std::ifstream infile_is;
-	infile_is.open(infilepath);
-	if(infile_is.fail())
-	{
-		std::cerr << "Failed to open '" << infilepath << "'" << std::endl;
-		return false;
-	}
-
-	while(std::getline(infile_is, line))
-	{
-		std::vector<int> v;
-		std::stringstream s (line);
-		while (getline(s, val, ','))
-			v.push_back(std::stoi(val));
-		indata.push_back(v);
-	}
-
-	infile_is.close();
-
-	return true;
-}
-
-
-bool WriteOutputData(std::string outfilename, std::vector<std::vector<int>> &outdata)
-{
-	std::string outfilepath = "../out/" + outfilename;
-	std::string line, val;
-	int i;
-
-	std::cout << "Writing data to '" << outfilepath << "'" << std::endl;
-
-	std::ofstream outfile_os;
-	outfile_os.open(outfilepath);
-	if(outfile_os.fail())
-	{
-		std::cerr << "Failed to open '" << outfilepath << "'" << std::endl;
-		return false;
-	}
-
-	for (auto &row : outdata)
-	{
-		if (row.size() == 1)
-		{
-			outfile_os << row[0] << '\n';
-		}
-		else
-		{
-			for (i = 0; i < (row.size() - 1); i++)
-				outfile_os << row[i] << ',';
-			outfile_os << row[i] << '\n';
-		}
-	}
-
-	outfile_os.close();
-
-	return true;
-}
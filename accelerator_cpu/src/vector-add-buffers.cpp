@@ -2,15 +2,29 @@
 #include <vector>
 #include <iostream>
 #include <string>
+#include <optional>
 #if FPGA_HARDWARE || FPGA_EMULATOR || FPGA_SIMULATOR
 #include <sycl/ext/intel/fpga_extensions.hpp>
 #endif
 
 #include "PngImage.hpp"
+#include "ImageStages.hpp"
+#include "PixelMath.hpp"
+#include "HostEngine.hpp"
+#include "MultiDevice.hpp"
+#include "Trace.hpp"
+#include "PerfAlloc.hpp"
+#include "Verify.hpp"
 
 // Determine if help message needs to print
 bool help = false;
 
+// Print the per stage timing table at the end (-p, --perf)
+bool perf_report = false;
+bool mem_report = false;
+bool counter_report = false;
+bool verify_output = false;
+
 // Max filename string legth
 constexpr int kMaxStringLen = 40;
 
@@ -23,6 +37,9 @@ template <int N> class KernelCompute;
 // num_repetitions: How many times to repeat the kernel invocation
 size_t num_repetitions = 1;
 
+// num_threads: Host engine worker count, 0 picks the hardware concurrency
+size_t num_threads = 0;
+
 // Vector type and data size for this example.
 size_t vector_size = 10000;
 
@@ -44,29 +61,200 @@ static auto exception_handler = [](sycl::exception_list e_list) {
     }
 };
 
-void VectorFlip(queue &q, const std::vector<uint64_t> &a, std::vector<uint64_t> &b, const size_t width, const size_t height) {
-    buffer a_buf(a);
-    buffer b_buf(b);
+// Run row(i, ...) for every row i of the image, num_repetitions times. row
+// gets read accessors of a, and of b if TwoInputs, then a write accessor of
+// out. The kernel reads every input and writes out once per repetition.
+template <bool TwoInputs, typename Row>
+void RowKernel(queue &q, const char *name, const std::vector<uint64_t> &a, const std::vector<uint64_t> *b,
+               std::vector<uint64_t> &out, const size_t height, Row row) {
+    // Buffers live in optionals so that building them and the writeback
+    // when they go away can be timed as stages of their own
+    std::optional<buffer<uint64_t, 1>> a_buf, b_buf, out_buf;
+    perf::ScopedZone construct("buffer construction");
+    a_buf.emplace(a);
+    if constexpr (TwoInputs)
+        b_buf.emplace(*b);
+    out_buf.emplace(out);
+    construct.End();
     auto start_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    const uint64_t bytes = (TwoInputs ? 3 : 2) * a.size() * sizeof(uint64_t);
+    perf::ScopedZone kernel("kernel", num_repetitions * bytes);
     for (size_t repetition = 0; repetition < num_repetitions; repetition++) {
-        q.submit([ & ](handler & h) {
-            accessor a(a_buf, h, read_only);
-            accessor b(b_buf, h, write_only);
-            h.parallel_for(height, [ = ](auto i) { // for each row
-                for (size_t j = 0; j < width; j++) // row each column
-                {
-                    b[(i*width)+j] = a[(i*width)+(width-1-j)]; // flip
-                }
-            });
+        event e = q.submit([ & ](handler & h) {
+            accessor in(*a_buf, h, read_only);
+            accessor o(*out_buf, h, write_only);
+            if constexpr (TwoInputs) {
+                accessor in2(*b_buf, h, read_only);
+                h.parallel_for(height, [ = ](auto i) { // for each row
+                    row(i, in, in2, o);
+                });
+            } else {
+                h.parallel_for(height, [ = ](auto i) { // for each row
+                    row(i, in, o);
+                });
+            }
         });
+        perf::TraceEvent(e, "sycl queue", name, bytes);
     };
     q.wait();
+    kernel.End();
+
+    auto end_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> process_time_compute_verbose(end_time_compute_verbose - start_time_compute_verbose);
+    std::cout << "Verbose computation was " << process_time_compute_verbose.count() << " milliseconds\n";
+
+    PERF_ZONE("buffer writeback");
+    a_buf.reset();
+    b_buf.reset();
+    out_buf.reset();
+}
+
+void VectorFlip(queue &q, const std::vector<uint64_t> &a, std::vector<uint64_t> &b, const size_t width, const size_t height) {
+    RowKernel<false>(q, "flip", a, nullptr, b, height, [=](size_t i, const auto &in, const auto &out) {
+        stage::FlipRow(in, out, i, width);
+    });
+}
+
+// Per-pixel kernel over one image, out[i] = op(a[i])
+template <typename PixelOp>
+void VectorPixelOp(queue &q, const std::vector<uint64_t> &a, std::vector<uint64_t> &b, const size_t width, const size_t height, PixelOp op) {
+    RowKernel<false>(q, PixelOp::kName, a, nullptr, b, height, [=](size_t i, const auto &in, const auto &out) {
+        stage::MapRow(in, out, i, width, op);
+    });
+}
+
+// Per-pixel kernel over two images, out[i] = op(a[i], b[i])
+template <typename PixelOp>
+void VectorPixelOp(queue &q, const std::vector<uint64_t> &a, const std::vector<uint64_t> &b, std::vector<uint64_t> &c, const size_t width, const size_t height, PixelOp op) {
+    RowKernel<true>(q, PixelOp::kName, a, &b, c, height, [=](size_t i, const auto &in, const auto &in2, const auto &out) {
+        stage::MapRow(in, in2, out, i, width, op);
+    });
+}
+
+// Host engine equivalent of VectorFlip, no SYCL runtime involved
+void HostFlip(const std::vector<uint64_t> &a, std::vector<uint64_t> &b, const size_t width, const size_t height) {
+    perf::ScopedZone start("thread pool start");
+    host::ThreadPool pool(num_threads == 0 ? std::thread::hardware_concurrency() : num_threads);
+    start.End();
+    const char *isa = nullptr;
+    host::FlipRowFn flip_row = host::SelectFlipRow(&isa);
+    std::cout << "Host engine: " << pool.size() << " threads, " << isa << " kernel\n";
+
+    auto start_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    perf::ScopedZone kernel("kernel", num_repetitions * 2 * a.size() * sizeof(uint64_t));
+    for (size_t repetition = 0; repetition < num_repetitions; repetition++) {
+        host::Flip(pool, flip_row, a.data(), b.data(), width, height);
+    }
+    kernel.End();
 
     auto end_time_compute_verbose = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> process_time_compute_verbose(end_time_compute_verbose - start_time_compute_verbose);
     std::cout << "Verbose computation was " << process_time_compute_verbose.count() << " milliseconds\n";
 }
 
+// Host engine equivalent of VectorPixelOp for brighten, blend and diff
+void HostPixelOp(const std::string &command, const px::Brighten &brighten, const px::Blend &blend,
+                 const std::vector<uint64_t> &a, const std::vector<uint64_t> &b, std::vector<uint64_t> &c) {
+    perf::ScopedZone start("thread pool start");
+    host::ThreadPool pool(num_threads == 0 ? std::thread::hardware_concurrency() : num_threads);
+    start.End();
+    const char *isa = nullptr;
+    host::PixelRowFns rows = host::SelectPixelRows(&isa);
+    std::cout << "Host engine: " << pool.size() << " threads, " << isa << " kernel\n";
+
+    auto start_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    uint64_t streams = command == "brighten" ? 2 : 3;  // Inputs plus the output
+    perf::ScopedZone kernel("kernel", num_repetitions * streams * a.size() * sizeof(uint64_t));
+    for (size_t repetition = 0; repetition < num_repetitions; repetition++) {
+        if (command == "brighten")
+            host::Brighten(pool, rows.brighten, brighten, a.data(), c.data(), a.size());
+        else if (command == "blend")
+            host::Blend(pool, rows.blend, blend, a.data(), b.data(), c.data(), a.size());
+        else if (command == "diff")
+            host::Diff(pool, rows.diff, a.data(), b.data(), c.data(), a.size());
+    }
+    kernel.End();
+
+    auto end_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> process_time_compute_verbose(end_time_compute_verbose - start_time_compute_verbose);
+    std::cout << "Verbose computation was " << process_time_compute_verbose.count() << " milliseconds\n";
+}
+
+// VectorFlip split across every SYCL device, rebalanced on measured throughput
+void MultiFlip(multi::DeviceShards &shards, const std::vector<uint64_t> &a, std::vector<uint64_t> &b, const size_t width, const size_t height) {
+    auto start_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    perf::ScopedZone kernel("kernel", num_repetitions * 2 * a.size() * sizeof(uint64_t));
+    for (size_t repetition = 0; repetition < num_repetitions; repetition++) {
+        shards.Flip(a.data(), b.data(), width, height);
+    }
+    kernel.End();
+
+    auto end_time_compute_verbose = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> process_time_compute_verbose(end_time_compute_verbose - start_time_compute_verbose);
+    std::cout << "Verbose computation was " << process_time_compute_verbose.count() << " milliseconds\n";
+
+    for (auto &shard : shards.shards()) {
+        std::cout << "  " << shard.name << ": " << shard.rows_done << " rows, "
+                  << shard.rows_per_ms << " rows/ms\n";
+    }
+}
+
+// One 16-bit channel of a packed pixel, 0 for r to 3 for a
+static inline int64_t Channel(uint64_t pixel, int k) {
+    return (pixel >> (48 - 16 * k)) & 0xFFFF;
+}
+
+// --verify: c against a host reference of the command, written out channel
+// by channel in plain integer math. It shares no code with the SWAR row
+// bodies of PixelMath.hpp and ImageStages.hpp that every engine runs, so
+// for the sycl and multi engines it checks those as well as the launch, the
+// row split and the buffer copies, and for the host engine its SIMD kernels.
+bool VerifyOutput(const std::string &command, const px::Brighten &brighten, const px::Blend &blend,
+                  const std::vector<uint64_t> &a, const std::vector<uint64_t> &b, const std::vector<uint64_t> &c,
+                  const size_t width, const size_t height) {
+    PERF_ZONE("verify");
+    bool flip = command == "flip", brightening = command == "brighten", blending = command == "blend";
+    int64_t add = Channel(brighten.offset_add, 0), sub = Channel(brighten.offset_sub, 0);
+    int64_t weight = blend.weight, inv_weight = (1 << 15) - blend.weight;
+    verify::Result<uint64_t> result = verify::Check(c.data(), width, height, [&](size_t first, size_t rows, uint64_t *out) {
+        for (size_t r = 0; r < rows; r++) {
+            const uint64_t *in = a.data() + (first + r) * width;
+            const uint64_t *in2 = b.empty() ? nullptr : b.data() + (first + r) * width;
+            uint64_t *row = out + r * width;
+            for (size_t j = 0; j < width; j++) {
+                if (flip) {
+                    row[j] = in[width - 1 - j];
+                    continue;
+                }
+                // Color channels clamp to 0..0xFFFF, alpha is the first input's
+                uint64_t x = in[j], y = in2 != nullptr ? in2[j] : 0;
+                uint64_t pixel = x & 0xFFFF;
+                for (int k = 0; k < 3; k++) {
+                    int64_t p = Channel(x, k), q = Channel(y, k), v;
+                    if (brightening) {
+                        v = std::min<int64_t>((p * brighten.gain + 128) >> 8, 0xFFFF);   // gain is Q8.8
+                        v = std::min<int64_t>(std::max<int64_t>(v - sub, 0) + add, 0xFFFF);
+                    } else if (blending) {
+                        v = (p * weight + q * inv_weight + (1 << 14)) >> 15;             // weight is Q15
+                    } else {
+                        v = p > q ? p - q : q - p;
+                    }
+                    pixel |= (uint64_t)v << (48 - 16 * k);
+                }
+                row[j] = pixel;
+            }
+        }
+    });
+    if (!result.ok) {
+        std::cerr << "Verification failed, first difference at row " << result.row << ", column " << result.col
+                  << ": expected 0x" << std::hex << result.expected << ", got 0x" << result.actual << std::dec << std::endl;
+        return false;
+    }
+    std::cout << "Verified " << width << "x" << height << " output against the host reference in " << result.bands
+              << " bands, digest " << std::hex << result.digest << std::dec << "\n";
+    return true;
+}
+
 //************************************
 // Initialize the vector from 0 to vector_size - 1
 //************************************
@@ -78,12 +266,32 @@ void Help(void) {
     // Command line arguments.
     // accelerator [command] -i=[input file] -o=[output file]
     // -h, --help
-    // future options?
-    // -p,performance : output perf metrics
-    std::cout << "accelerator [command] -i=<input file> -o=<output file>\n";
+    // -p, --perf
+    std::cout << "accelerator [command] -i=<input file> -o=<output file> [options] <# repetitions>\n";
     std::cout << "  -h,--help                                : this help text\n";
+    std::cout << "  -p,--perf                                : print the time spent in each stage\n";
+    std::cout << "  --verify                                 : check the output against a host reference\n";
+    std::cout << "  --mem                                    : -p plus the allocations and resident memory\n";
+    std::cout << "                                             of each stage\n";
+    std::cout << "  --counters                               : -p plus cycles, IPC and cache, dTLB and branch\n";
+    std::cout << "                                             misses of each stage (perf_event_open)\n";
+    std::cout << "  --peak-gbps=<n>                          : memory bandwidth -p compares kernels to\n";
+    std::cout << "                                             (default: measured with a STREAM copy)\n";
+    std::cout << "  --trace=<file>                           : write host stages and device kernels as a\n";
+    std::cout << "                                             Chrome trace, for Perfetto\n";
+    std::cout << "  -i2=<input file>                         : second image of blend and diff\n";
+    std::cout << "  --gain=<percent>                         : brighten gain (default 100)\n";
+    std::cout << "  --offset=<n>                             : brighten offset, may be negative (default 0)\n";
+    std::cout << "  --weight=<percent>                       : blend weight of the first image (default 50)\n";
+    std::cout << "  --engine=<sycl|host|multi>               : compute engine (default sycl)\n";
+    std::cout << "                                             multi shards rows over every SYCL device\n";
+    std::cout << "  --threads=<n>                            : host engine threads (default all)\n";
     std::cout << "  [command]                                                \n";
     std::cout << "      flip                             : flip vectors  \n";
+    std::cout << "      brighten                         : gain then offset per channel, saturating\n";
+    std::cout << "      blend                            : weighted mix of two images\n";
+    std::cout << "      diff                             : absolute difference of two images\n";
+    std::cout << "  Channel arithmetic clamps to 0..65535 and leaves alpha untouched.\n";
 }
 
 bool FindGetArg(std::string & arg,
@@ -141,15 +349,24 @@ img::PNG_PIXEL_RGBA_16_ROWS create_blank_2d_vector(img::PNG_PIXEL_RGBA_16_ROWS t
 // Demonstrate vector add both in sequential on CPU and in parallel on device.
 //************************************
 int main(int argc, char * argv[]) {
-    std::vector<std::vector<uint64_t>> indata_vec, outdata_vec;
-    std::vector<uint64_t> indata_vec_flat, outdata_vec_flat;
+    std::vector<uint64_t> indata_vec_flat, outdata_vec_flat, indata2_vec_flat;
     char out_file_str_buffer[kMaxStringLen] = {0};
     char in_file_str_buffer[kMaxStringLen] = {0};
+    char in2_file_str_buffer[kMaxStringLen] = {0};
+    char engine_str_buffer[kMaxStringLen] = {0};
+    char trace_str_buffer[kMaxStringLen] = {0};
+    char peak_str_buffer[kMaxStringLen] = {0};
+    int threads_arg = 0;
+    int gain_percent = 100;
+    int offset = 0;
+    int weight_percent = 50;
     img::PNG_PIXEL_RGBA_16_ROWS outdata;
     img::PNG_PIXEL_RGBA_16_ROWS indata;
     std::string outfilename = "";
     std::string infilename = "";
+    std::string infilename2 = "";
     std::string command = "";
+    std::string engine = "sycl";
 
     // Create device selector for the device of your interest.
     #if FPGA_EMULATOR
@@ -167,15 +384,15 @@ int main(int argc, char * argv[]) {
     #endif
 
     // Argument processing
-    if(argc != 5) {
+    if(argc < 5) {
         std::cerr << "Incorrect number of arguments. Correct usage: "
               << argv[0]
-              << " [command] -i=<input-file> -o=<output-file> <# repetitions> <# threads>"
+              << " [command] -i=<input-file> -o=<output-file> [options] <# repetitions>"
               << std::endl;
         return 1;
     }
 
-    for(int i = 1; i < argc-2; i++) {
+    for(int i = 1; i < argc-1; i++) {
         if(argv[i][0] == '-') {
             std::string sarg(argv[i]);
             if(std::string(argv[i]) == "-h") {
@@ -184,12 +401,35 @@ int main(int argc, char * argv[]) {
             if(std::string(argv[i]) == "--help") {
                 help = true;
             }
+            if(sarg == "-p" || sarg == "--perf") {
+                perf_report = true;
+            }
+            if(sarg == "--mem") {
+                perf_report = true;
+                mem_report = true;
+            }
+            if(sarg == "--counters") {
+                perf_report = true;
+                counter_report = true;
+            }
+            if(sarg == "--verify") {
+                verify_output = true;
+            }
             FindGetArgString(sarg, "-i=", in_file_str_buffer, kMaxStringLen);
             FindGetArgString(sarg, "-in=", in_file_str_buffer, kMaxStringLen);
             FindGetArgString(sarg, "--input-file=", in_file_str_buffer, kMaxStringLen);
             FindGetArgString(sarg, "-o=", out_file_str_buffer, kMaxStringLen);
             FindGetArgString(sarg, "-out=", out_file_str_buffer, kMaxStringLen);
             FindGetArgString(sarg, "--output-file=", out_file_str_buffer, kMaxStringLen);
+            FindGetArgString(sarg, "--engine=", engine_str_buffer, kMaxStringLen);
+            FindGetArgString(sarg, "--trace=", trace_str_buffer, kMaxStringLen);
+            FindGetArgString(sarg, "--peak-gbps=", peak_str_buffer, kMaxStringLen);
+            FindGetArg(sarg, "--threads=", 0, &threads_arg);
+            FindGetArgString(sarg, "-i2=", in2_file_str_buffer, kMaxStringLen);
+            FindGetArgString(sarg, "--input-file2=", in2_file_str_buffer, kMaxStringLen);
+            FindGetArg(sarg, "--gain=", 100, &gain_percent);
+            FindGetArg(sarg, "--offset=", 0, &offset);
+            FindGetArg(sarg, "--weight=", 50, &weight_percent);
         } else {
             command = std::string(argv[i]);
         }
@@ -200,103 +440,232 @@ int main(int argc, char * argv[]) {
         return 1;
     }
 
-    num_repetitions = atoi(argv[4]);
+    // Both become size_t, where a negative count would wrap to a huge one
+    int repetitions_arg = atoi(argv[argc-1]);
+    if(repetitions_arg < 1 || threads_arg < 0) {
+        std::cerr << "The repetitions must be at least 1 and --threads at least 0" << std::endl;
+        return 1;
+    }
+    num_repetitions = repetitions_arg;
+    num_threads = threads_arg;
     infilename = std::string(in_file_str_buffer);
     outfilename = std::string(out_file_str_buffer);
-    std::cout << "Command: " << command << ", input file: " << infilename << ", output file: " << outfilename << std::endl;
+    if(engine_str_buffer[0] != 0)
+        engine = std::string(engine_str_buffer);
+    if(engine != "sycl" && engine != "host" && engine != "multi") {
+        std::cerr << "Unknown engine '" << engine << "', expected sycl, host or multi" << std::endl;
+        return 1;
+    }
+    infilename2 = std::string(in2_file_str_buffer);
+    bool two_inputs = command == "blend" || command == "diff";
+    if(command != "flip" && command != "brighten" && !two_inputs) {
+        std::cerr << "Unknown command '" << command << "'" << std::endl;
+        Help();
+        return 1;
+    }
+    if(two_inputs && infilename2.empty()) {
+        std::cerr << "Command '" << command << "' needs a second image, -i2=<input-file>" << std::endl;
+        return 1;
+    }
+    if(engine == "multi" && command != "flip") {
+        std::cerr << "The multi engine only supports flip" << std::endl;
+        return 1;
+    }
+    px::Brighten brighten = px::MakeBrighten(gain_percent, offset);
+    px::Blend blend = px::MakeBlend(weight_percent);
+    std::cout << "Command: " << command << ", input file: " << infilename;
+    if(two_inputs)
+        std::cout << ", second input file: " << infilename2;
+    std::cout << ", output file: " << outfilename << ", engine: " << engine << std::endl;
+
+    std::string tracefilename(trace_str_buffer);
+    if(perf_report) {
+        if(peak_str_buffer[0] != 0)
+            perf::SetPeak(atof(peak_str_buffer), "--peak-gbps");
+        else
+            perf::SetPeak(perf::MeasureStreamCopy(), "host STREAM copy");
+        // Device kernels are recorded too, for the bandwidth table
+        perf::EnableTrace();
+    }
+    if(!tracefilename.empty())
+        perf::EnableTrace();
+    if(mem_report)
+        perf::EnableMemory();
+    // Before any thread pool or queue, their threads inherit the counters
+    if(counter_report)
+        perf::EnableCounters();
 
     auto start_time = std::chrono::high_resolution_clock::now();
 
     // PNG Input
+    perf::ScopedZone decode("PNG decode");
     img::PNG png(std::filesystem::path("../in/" + infilename));
-    indata = png.asRGBA16();
+    decode.End();
+    {
+        PERF_ZONE("asRGBA16");
+        indata = png.asRGBA16();
+    }
+    if(indata.empty()) {
+        std::cerr << "'" << infilename << "' has no pixels" << std::endl;
+        return 1;
+    }
     size_t width = indata[0].size();
     size_t height = indata.size();
+    perf::SetItems(width * height, "px");
 
-    outdata = create_blank_2d_vector(indata);
-
-    // Create 2d uint64_t vectors from PNG data
-    for (size_t i = 0; i < height; i++) {
-        std::vector<uint64_t> new_row;
-
-        for (size_t j = 0; j < width; j++) {
-            new_row.push_back(static_cast<uint64_t>(indata[i][j]));
-        }
-
-        indata_vec.push_back(new_row);
+    {
+        PERF_ZONE("output rows");
+        outdata = create_blank_2d_vector(indata);
     }
-    for (auto row : indata_vec)
+
+    // Pack the PNG rows into one flat vector
     {
-        std::vector<uint64_t> new_row;
-        new_row.resize(row.size());
-        outdata_vec.push_back(new_row);
+        PERF_ZONE("flatten");
+        stage::Flatten(indata, indata_vec_flat);
+        outdata_vec_flat.resize(indata_vec_flat.size());
     }
 
-    // Flatten the 2d vectors
-    for (size_t i = 0; i < height; i++) {
-        for (size_t j = 0; j < width; j++) {
-            indata_vec_flat.push_back(indata_vec[i][j]);
+    // Second image for the two input commands, same packing as the first
+    if(two_inputs) {
+        perf::ScopedZone decode2("PNG decode");
+        img::PNG png2(std::filesystem::path("../in/" + infilename2));
+        decode2.End();
+        img::PNG_PIXEL_RGBA_16_ROWS indata2;
+        {
+            PERF_ZONE("asRGBA16");
+            indata2 = png2.asRGBA16();
+        }
+        // An image without rows has no indata2[0] to take the width of
+        size_t width2 = indata2.empty() ? 0 : indata2[0].size();
+        if(indata2.size() != height || width2 != width) {
+            std::cerr << "Image sizes differ: " << width << "x" << height << " and "
+                      << width2 << "x" << indata2.size() << std::endl;
+            return 1;
         }
+        PERF_ZONE("flatten");
+        stage::Flatten(indata2, indata2_vec_flat);
     }
-    outdata_vec_flat.resize(indata_vec_flat.size());
-
-    try {
-        queue q(selector, exception_handler);
-
-        // Print out the device information used for the kernel code.
-        std::cout << "Running on device: " << q.get_device().get_info < info::device::name > () << "\n";
 
+    if(engine == "host") {
         auto start_time_compute = std::chrono::high_resolution_clock::now();
+        PERF_ZONE(command.c_str());
 
         if(command.compare("flip") == 0) {
             std::cout << "Preforming data flip\n";
-            VectorFlip(q, indata_vec_flat, outdata_vec_flat, width, height);
+            HostFlip(indata_vec_flat, outdata_vec_flat, width, height);
+        } else {
+            std::cout << "Preforming data " << command << "\n";
+            HostPixelOp(command, brighten, blend, indata_vec_flat, indata2_vec_flat, outdata_vec_flat);
         }
 
         auto end_time_compute = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double, std::milli> process_time_compute(end_time_compute - start_time_compute);
         std::cout << "Computation was " << process_time_compute.count() << " milliseconds\n";
+    } else if(engine == "multi") {
+        try {
+            perf::ScopedZone discovery("device discovery");
+            multi::DeviceShards shards(exception_handler);
+            discovery.End();
+
+            for (auto &shard : shards.shards()) {
+                std::cout << "Running on device: " << shard.name << "\n";
+            }
+
+            auto start_time_compute = std::chrono::high_resolution_clock::now();
+            perf::ScopedZone compute(command.c_str());
+
+            if(command.compare("flip") == 0) {
+                std::cout << "Preforming data flip\n";
+                MultiFlip(shards, indata_vec_flat, outdata_vec_flat, width, height);
+            }
+
+            auto end_time_compute = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> process_time_compute(end_time_compute - start_time_compute);
+            std::cout << "Computation was " << process_time_compute.count() << " milliseconds\n";
 
-    } catch (exception const & e) {
-        std::cout << "An exception is caught for vector add.\n";
-        std::terminate();
+        } catch (std::exception const & e) {
+            // A device failing mid-flip ends the run, not the process
+            std::cerr << "The multi engine failed: " << e.what() << std::endl;
+            return 1;
+        }
+    } else {
+        try {
+            perf::ScopedZone creation("queue creation");
+            queue q(selector, exception_handler, perf::QueueProperties());
+            creation.End();
+
+            // Print out the device information used for the kernel code.
+            std::cout << "Running on device: " << q.get_device().get_info < info::device::name > () << "\n";
+
+            auto start_time_compute = std::chrono::high_resolution_clock::now();
+            perf::ScopedZone compute(command.c_str());
+
+            if(command.compare("flip") == 0) {
+                std::cout << "Preforming data flip\n";
+                VectorFlip(q, indata_vec_flat, outdata_vec_flat, width, height);
+            } else if(command.compare("brighten") == 0) {
+                std::cout << "Preforming data brighten\n";
+                VectorPixelOp(q, indata_vec_flat, outdata_vec_flat, width, height, brighten);
+            } else if(command.compare("blend") == 0) {
+                std::cout << "Preforming data blend\n";
+                VectorPixelOp(q, indata_vec_flat, indata2_vec_flat, outdata_vec_flat, width, height, blend);
+            } else if(command.compare("diff") == 0) {
+                std::cout << "Preforming data diff\n";
+                VectorPixelOp(q, indata_vec_flat, indata2_vec_flat, outdata_vec_flat, width, height, px::Diff{});
+            }
+
+            auto end_time_compute = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> process_time_compute(end_time_compute - start_time_compute);
+            std::cout << "Computation was " << process_time_compute.count() << " milliseconds\n";
+
+        } catch (exception const & e) {
+            std::cout << "An exception is caught for vector add.\n";
+            std::terminate();
+        }
     }
+    bool verified = !verify_output ||
+                    VerifyOutput(command, brighten, blend, indata_vec_flat, indata2_vec_flat, outdata_vec_flat, width, height);
     std::cout << "W: " << width << " H: " << height << " oudata_vec_flat size: " << outdata_vec_flat.size() << std::endl;
     std::cout << "Outdata size: " << outdata.size() << std::endl;
     // Convert uint64_t data to PNG output data
-    for (size_t i = 0; i < height; i++) {
-        for (size_t j = 0; j < width; j++) {
-            uint64_t val = outdata_vec_flat[(i*width)+j];
-
-            // Convert uint64_t to PNG_PIXEL_RGBA
-            img::PNG_PIXEL_RGBA<uint16_t> tmp;
-            uint16_t r = (uint16_t)(val >> 48);
-            uint16_t g = (uint16_t)(val >> 32) & 0xFFFF;
-            uint16_t b = (uint16_t)(val >> 16) & 0xFFFF;
-            uint16_t a = (uint16_t)(val & 0xFFFF);
-            tmp.data[0] = r;
-            tmp.data[1] = g;
-            tmp.data[2] = b;
-            tmp.data[3] = a;
-            tmp.rgba.r = r;
-            tmp.rgba.g = g;
-            tmp.rgba.b = b;
-            tmp.rgba.a = a;
-
-            outdata[i][j] = tmp;
-        }
+    {
+        PERF_ZONE("unflatten");
+        stage::Unflatten(outdata_vec_flat, outdata);
     }
 
-
     // PNG Output
-    png.fromRGBA16(outdata);
-    png.saveToFile(std::filesystem::path("../out/test.png"));
+    {
+        PERF_ZONE("fromRGBA16");
+        png.fromRGBA16(outdata);
+    }
+    {
+        PERF_ZONE("saveToFile");
+        png.saveToFile(std::filesystem::path("../out/test.png"));
+    }
 
     auto end_time = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> process_time(end_time - start_time);
 
     std::cout << "Computation and I/O was " << process_time.count() << " milliseconds\n";
 
+    if(perf_report) {
+        perf::PrintReport();
+        perf::PrintDeviceReport();
+        perf::PrintMemoryReport();
+        perf::PrintCounterReport();
+    }
+    if(!tracefilename.empty()) {
+        if(!perf::WriteTrace(tracefilename)) {
+            std::cerr << "Failed to write '" << tracefilename << "'" << std::endl;
+            return 1;
+        }
+        std::cout << "Trace written to '" << tracefilename << "'\n";
+    }
+
+    if(!verified) {
+        std::cerr << "Output does not match the host reference" << std::endl;
+        return 1;
+    }
     std::cout << "Vector add successfully completed on device.\n";
     return 0;
 }
@@ -0,0 +1,117 @@
+// pipeline_test.cpp
+//
+// Checks of the streaming CSV pipeline (Pipeline.hpp) on inputs where the
+// block boundaries and the end of the files are easy to get wrong. Each
+// case writes its inputs to a scratch in/ directory, streams them through
+// stream::Run with a host sum as the compute step, and checks the shape
+// and the text written to out/.
+//
+// use: ./pipeline_test, or ctest from build/
+//
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Pipeline.hpp"
+
+using Block = stream::Block<int, AlignedAllocator<int>>;
+
+static void WriteFile(const std::string &path, const std::string &text) {
+	std::ofstream f(path, std::ios::binary);
+	f << text;
+}
+
+static std::string ReadFile(const std::string &path) {
+	std::ifstream f(path, std::ios::binary);
+	std::stringstream ss;
+	ss << f.rdbuf();
+	return ss.str();
+}
+
+// Stream the inputs, named by the text they hold, into their elementwise
+// sum. Returns stream::Run's result and the output text.
+static bool Sum(const std::vector<std::string> &inputs, size_t &rows, size_t &cols, std::string &out) {
+	std::vector<std::string> names;
+	for(size_t k = 0; k < inputs.size(); k++) {
+		names.push_back("in" + std::to_string(k) + ".csv");
+		WriteFile("../in/" + names.back(), inputs[k]);
+	}
+	bool ok = stream::Run<int>(names, "out.csv", AlignedAllocator<int>(), rows, cols,
+		[](Block &block) {
+			block.output.resize(block.rows, block.cols);
+			for(size_t i = 0; i < block.rows * block.cols; i++) {
+				int sum = 0;
+				for(auto &input : block.inputs)
+					sum += input.data()[i];
+				block.output.data()[i] = sum;
+			}
+		});
+	out = ReadFile("../out/out.csv");
+	return ok;
+}
+
+static std::string Repeat(const std::string &line, size_t times) {
+	std::string text;
+	text.reserve(line.size() * times);
+	for(size_t i = 0; i < times; i++)
+		text += line;
+	return text;
+}
+
+static size_t failures = 0;
+
+static void Check(bool ok, const std::string &what) {
+	std::cout << (ok ? "PASS " : "FAIL ") << what << std::endl;
+	if(!ok)
+		failures++;
+}
+
+int main(int argc, char *argv[]) {
+	// Run reads ../in and writes ../out, relative to a scratch work/
+	char root[] = "/tmp/pipeline_test.XXXXXX";
+	if(mkdtemp(root) == nullptr) {
+		std::cerr << "Failed to create a scratch directory" << std::endl;
+		return 1;
+	}
+	std::string base(root);
+	mkdir((base + "/in").c_str(), 0755);
+	mkdir((base + "/out").c_str(), 0755);
+	mkdir((base + "/work").c_str(), 0755);
+	if(chdir((base + "/work").c_str()) != 0) {
+		std::cerr << "Failed to enter '" << base << "/work'" << std::endl;
+		return 1;
+	}
+
+	size_t rows, cols;
+	std::string out;
+
+	// A trailing blank line is not a row, in either input
+	const std::string a = "1,2\n3,4\n";
+	const std::string b = a + "\n";
+	bool ok = Sum({a, b}, rows, cols, out);
+	Check(ok && rows == 2 && cols == 2 && out == "2,4\n6,8\n", "trailing blank line in the second input");
+	ok = Sum({b, a}, rows, cols, out);
+	Check(ok && rows == 2 && cols == 2 && out == "2,4\n6,8\n", "trailing blank line in the first input");
+
+	// 2^21 rows of "1,2\n" fill the first block to exactly kBlockBytes, so
+	// the blank line is a block of its own
+	const size_t many = size_t(1) << 21;
+	static_assert((size_t(1) << 21) * 4 == stream::kBlockBytes, "the rows must fill one block exactly");
+	ok = Sum({Repeat("1,2\n", many) + "\n"}, rows, cols, out);
+	Check(ok && rows == many && cols == 2 && out == Repeat("1,2\n", many),
+	      "trailing blank line past a full block");
+
+	// Blank lines are still an error before the last row
+	ok = Sum({"1,2\n\n3,4\n"}, rows, cols, out);
+	Check(!ok, "blank line between rows");
+
+	system(("rm -rf " + base).c_str());
+	std::cout << failures << " failure" << (failures == 1 ? "" : "s") << std::endl;
+	return failures == 0 ? 0 : 1;
+}
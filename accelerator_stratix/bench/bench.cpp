@@ -0,0 +1,138 @@
+// bench.cpp
+//
+// Benchmark of flip and composite through the producer/consumer lanes of
+// vector-add-buffers, on the kernels of Lanes.hpp. The stages, statistics,
+// baselines and options are common/Bench.hpp's.
+//
+// The lane buffers are use_host_ptr buffers, so the upload happens when the
+// first kernel runs and is part of "kernel"; there is no "h2d". "d2h" is the
+// host accessors that bring every consumer band back. As in the --serve
+// daemon, the buffers and a composite overlay are kept from one run to the
+// next, so after the warmup runs "decode" is the input's alone.
+//
+// use (from build/, inputs are read from ../in/):
+//   ./bench -i=test3.png --commands=flip,composite --reps=1,10 --samples=10
+//   ./bench -i=test3.png --commands=composite -i2=logo.png --broadcast=1
+//   ./bench -i=test3.png --commands=flip,composite --samples=20 --profile=s10-pac --save-baseline
+//   ./bench --profile=s10-pac --compare
+//
+
+#include <sycl/sycl.hpp>
+#if FPGA_HARDWARE || FPGA_EMULATOR || FPGA_SIMULATOR
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#endif
+#include <vector>
+#include <string>
+#include <iostream>
+#include <filesystem>
+
+#include "PngImage.hpp"
+#include "Lanes.hpp"
+#include "Bench.hpp"
+
+using bench::Clock;
+using bench::Ms;
+
+// Create an exception handler for asynchronous SYCL exceptions
+static auto exception_handler = [](sycl::exception_list e_list) {
+    for(std::exception_ptr const & e: e_list) {
+        try {
+            std::rethrow_exception(e);
+        } catch (std::exception const & e) {
+            std::cerr << "Asynchronous SYCL exception: " << e.what() << std::endl;
+            std::terminate();
+        }
+    }
+};
+
+// Flip and composite on NUM_LANES lanes, with the buffers of a Session
+class LanesEngine : public bench::Engine {
+public:
+    template <typename Selector>
+    LanesEngine(Selector selector, bool broadcast)
+        : m_q(selector, exception_handler), m_session(m_q), m_broadcast(broadcast) {}
+
+    std::string name(void) const override { return "lanes"; }
+    std::string description(void) const override {
+        return m_q.get_device().get_info<sycl::info::device::name>() + ", " + std::to_string(NUM_LANES) + " lanes";
+    }
+
+    std::vector<double> Sample(const std::string &command, const std::string &input, const std::string &input2,
+                               size_t reps, size_t &width, size_t &height) override {
+        std::vector<double> ms(bench::kStages.size(), -1);
+        bool composite = command == "composite";
+        Session &s = m_session;
+
+        auto t0 = Clock::now();
+        img::PNG png(std::filesystem::path("../in/" + input));
+        img::PNG_PIXEL_RGBA_16_ROWS rows = png.asRGBA16();
+        width = rows[0].size();
+        height = rows.size();
+        std::string error;
+        if(composite && !LoadOverlay(s, input2, m_broadcast, width, height, error))
+            throw std::runtime_error(error);
+        // Images without an alpha channel load with alpha 0, as in the driver
+        bool opaque = png.channels() != 4;
+
+        auto t1 = Clock::now();
+        Fit(s, width, height);
+        FlattenLanes(s, rows, composite && opaque);
+
+        auto t2 = Clock::now();
+        for (size_t repetition = 0; repetition < reps; repetition++) {
+            if(composite)
+                Composite(m_q, s.producer_buffers, *s.overlay_buffer, s.consumer_buffers,
+                          width, height, s.overlay.cols(), s.overlay.rows());
+            else
+                Flip(m_q, s.producer_buffers, s.consumer_buffers, width, height);
+            m_q.wait();
+        }
+
+        auto t3 = Clock::now();
+        WritebackLanes(s);
+
+        auto t4 = Clock::now();
+        UnflattenLanes(s, rows, composite && !opaque);
+
+        auto t5 = Clock::now();
+        png.fromRGBA16(rows);
+        png.saveToFile(std::filesystem::path("../out/bench.png"));
+        auto t6 = Clock::now();
+
+        ms[0] = Ms(t0, t1);
+        ms[1] = Ms(t1, t2);
+        ms[3] = Ms(t2, t3);
+        ms[4] = Ms(t3, t4);
+        ms[5] = Ms(t4, t5);
+        ms[6] = Ms(t5, t6);
+        ms[7] = Ms(t0, t6);
+        return ms;
+    }
+
+private:
+    sycl::queue m_q;
+    Session m_session;
+    bool m_broadcast;
+};
+
+int main(int argc, char * argv[]) {
+    bench::Suite suite;
+    suite.commands = {"flip", "composite"};
+    suite.two_input_commands = {"composite"};
+    suite.engines = {"lanes"};
+    suite.default_engines = {"lanes"};
+    suite.params = {{"broadcast", 0, "1 to tile an overlay smaller than the image"}};
+    suite.make_engine = [](const std::string &name, const bench::Config &config) -> bench::Engine * {
+        bool broadcast = config.param("broadcast") != 0;
+        #if FPGA_EMULATOR
+        return new LanesEngine(sycl::ext::intel::fpga_emulator_selector_v, broadcast);
+        #elif FPGA_SIMULATOR
+        return new LanesEngine(sycl::ext::intel::fpga_simulator_selector_v, broadcast);
+        #elif FPGA_HARDWARE
+        return new LanesEngine(sycl::ext::intel::fpga_selector_v, broadcast);
+        #else
+        return new LanesEngine(sycl::default_selector_v, broadcast);
+        #endif
+    };
+    return bench::Main(argc, argv, suite);
+}
@@ -0,0 +1,157 @@
+// client.cpp
+//
+// accelerator-client sends one job to a "vector-add-buffers --serve" daemon
+// and waits for it. The daemon already holds the queue, the kernels and the
+// lane buffers, so a job costs its own work and not the start of the
+// runtime and the device. Arguments other than the client's own go to the
+// daemon as they are, and the repetitions may be left out (1).
+//
+// use (from build/, files are in ../in/ and ../out/ as usual):
+//   ./vector-add-buffers.fpga --serve --warmup=test3.png &
+//   ./accelerator-client flip -i=test3.png -o=test3_out.png
+//   ./accelerator-client --upload=test3.png flip -i=shm:frame -o=shm:flipped 100
+//   ./accelerator-client stop
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <unistd.h>
+#include <png.h>
+
+#include "PngImage.hpp"
+#include "Serve.hpp"
+
+// Max filename string length
+constexpr int kMaxStringLen = 256;
+
+bool FindGetArgString(std::string &arg, const char *str, char *str_value, size_t maxchars)
+{
+	if (arg.compare(0, strlen(str), str) != 0)
+		return false;
+	strncpy(str_value, &arg.c_str()[strlen(str)], maxchars - 1);
+	str_value[maxchars - 1] = 0;
+	return true;
+}
+
+void Help(void)
+{
+	std::cout << "accelerator-client [options] [command] -i=<input file> -o=<output file> [options] [<# repetitions>]\n";
+	std::cout << "accelerator-client [options] stop\n";
+	std::cout << "  -h,--help                                : this help text\n";
+	std::cout << "  --socket=<path>                          : daemon socket (default " << serve::kDefaultSocket << ")\n";
+	std::cout << "  --upload=<png>                           : decode ../in/<png> into the shared memory\n";
+	std::cout << "                                             image -i=shm:<name> before sending the job\n";
+	std::cout << "  Every other argument is the job, as vector-add-buffers takes it.\n";
+	std::cout << "  -i= and -o= take shm:<name> for a shared memory image of packed\n";
+	std::cout << "  16-bit RGBA pixels, see Serve.hpp.\n";
+}
+
+// Pack ../in/<filename> into the shared memory image name, as the lanes
+// take it. Images without an alpha channel get an opaque one.
+bool Upload(const std::string &filename, const std::string &name)
+{
+	try
+	{
+		img::PNG png("../in/" + filename);
+		img::PNG_PIXEL_RGBA_16_ROWS rows = png.asRGBA16();
+		serve::SharedImage image;
+		std::string error;
+		if (!image.Create(name, png.width(), png.height(), error))
+		{
+			std::cerr << error << std::endl;
+			return false;
+		}
+		uint64_t *dst = image.data();
+		for (auto &row : rows)
+		{
+			for (auto pixel : row)
+			{
+				if (png.channels() != 4)
+					pixel.rgba.a = 0xFFFF;
+				*dst++ = static_cast<uint64_t>(pixel);
+			}
+		}
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << "Could not upload '" << filename << "': " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	char socket_str_buffer[kMaxStringLen] = {0};
+	char upload_str_buffer[kMaxStringLen] = {0};
+	std::vector<std::string> job;
+	std::string input;
+	bool help = argc < 2;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string sarg(argv[i]);
+		if (sarg == "-h" || sarg == "--help")
+			help = true;
+		else if (!FindGetArgString(sarg, "--socket=", socket_str_buffer, kMaxStringLen) &&
+			 !FindGetArgString(sarg, "--upload=", upload_str_buffer, kMaxStringLen))
+			job.push_back(sarg);
+		for (const char *option : {"-i=", "-in=", "--input-file="})
+		{
+			if (sarg.compare(0, strlen(option), option) == 0)
+				input = sarg.substr(strlen(option));
+		}
+	}
+
+	if (help || job.empty())
+	{
+		Help();
+		return 1;
+	}
+
+	std::string socket_path = socket_str_buffer[0] != 0 ? socket_str_buffer : serve::kDefaultSocket;
+	if (upload_str_buffer[0] != 0)
+	{
+		if (!serve::IsShm(input))
+		{
+			std::cerr << "--upload needs a shared memory input, -i=shm:<name>" << std::endl;
+			return 1;
+		}
+		if (!Upload(upload_str_buffer, input))
+			return 1;
+	}
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+	std::string error;
+	int fd = serve::Connect(socket_path, error);
+	if (fd < 0)
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	std::string reply;
+	serve::LineReader reader(fd);
+	bool sent = serve::SendRequest(fd, job) && reader.Next(reply);
+	close(fd);
+	std::chrono::duration<double, std::milli> round_trip(std::chrono::high_resolution_clock::now() - start_time);
+	if (!sent)
+	{
+		std::cerr << "No reply from '" << socket_path << "'" << std::endl;
+		return 1;
+	}
+
+	if (reply.compare(0, 3, "ok ") != 0)
+	{
+		std::cerr << (reply.compare(0, 6, "error ") == 0 ? reply.substr(6) : reply) << std::endl;
+		return 1;
+	}
+	std::cout << "Job took " << reply.substr(3) << " milliseconds, " << round_trip.count()
+		  << " milliseconds round trip\n";
+	return 0;
+}
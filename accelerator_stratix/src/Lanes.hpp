@@ -0,0 +1,576 @@
+// Lanes.hpp
+//
+// The flip and composite kernels of vector-add-buffers: NUM_LANES
+// producer/consumer pairs joined by pipes, each on its own band of rows and
+// its own memory channels, and the Session that keeps their buffers from
+// one run to the next. The driver and the bench both use them, so the bench
+// times the kernels the driver runs.
+//
+
+#ifndef LANES_HPP__
+#define LANES_HPP__
+
+#include <sycl/sycl.hpp>
+#if FPGA_HARDWARE || FPGA_EMULATOR || FPGA_SIMULATOR
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#endif
+#include <vector>
+#include <string>
+#include <iostream>
+#include <utility>
+#include <optional>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "Matrix.hpp"
+#include "PngImage.hpp"
+#include "hot_shapes.hpp"
+#include "Trace.hpp"
+#include "Verify.hpp"
+
+// Design parameters, overridable with -D for the sweep targets
+#ifndef ELEMENTS_PER_DDR_ACCESS
+#define ELEMENTS_PER_DDR_ACCESS 16      // Pixels moved per loop iteration
+#endif
+#ifndef LOOP_COALESCE
+#define LOOP_COALESCE 3                 // intel::loop_coalesce nesting depth
+#endif
+#ifndef UNROLL_FACTOR
+#define UNROLL_FACTOR ELEMENTS_PER_DDR_ACCESS  // Unroll of the per-access loop
+#endif
+#ifndef PIPE_DEPTH
+#define PIPE_DEPTH 1000                 // Producer to consumer pipe capacity
+#endif
+#ifndef NUM_LANES
+#define NUM_LANES 2                     // Producer/consumer kernel pairs
+#endif
+#ifndef LSU_POLICY
+#define LSU_POLICY BurstCoalesced       // Memory port style, see lsu_policy
+#endif
+constexpr int kNumMemChannels = 4;      // DDR channels on the S10 PAC
+constexpr double kMemChannelGBps = 19.2; // DDR4-2400, 64 bits wide, per channel
+
+template <int Lane, size_t W, size_t H> class ProducerKernel;  // Forward declare kernel name
+template <int Lane, size_t W, size_t H> class ConsumerKernel;  // Forward declare kernel name
+template <int Lane> class ProducerConsumerPipe;                // Forward declare pipe name
+template <int Lane, bool Tile> class CompositeKernel;          // Forward declare kernel name
+
+// Image dimensions, set per submission as specialization constants so the
+// JIT sees them as constants. Compile-time shapes (HOT_SHAPES) bypass these.
+constexpr sycl::specialization_id<size_t> kWidthSpec{0};
+constexpr sycl::specialization_id<size_t> kHeightSpec{0};
+
+// LSU POLICIES
+// Load-store unit used for the producer read port and the consumer write
+// port. Prefetching and caching only exist for loads, so the store side of
+// every policy is a plain burst-coalesced LSU.
+namespace lsu_policy {
+    using namespace sycl::ext::intel;
+
+    // Let the compiler infer the LSU, as plain accessors do
+    struct Inferred {
+        using Load = lsu<>;
+        using Store = lsu<>;
+        static constexpr const char *kLoadName = "inferred";
+        static constexpr const char *kStoreName = "inferred";
+    };
+
+    struct BurstCoalesced {
+        using Load = lsu<burst_coalesce<true>, statically_coalesce<false>>;
+        using Store = lsu<burst_coalesce<true>, statically_coalesce<false>>;
+        static constexpr const char *kLoadName = "burst-coalesced";
+        static constexpr const char *kStoreName = "burst-coalesced";
+    };
+
+    // Streaming prefetcher on the read side. It reads ahead at rising
+    // addresses, as the composite producers walk each row. The flip
+    // producers walk each row from its end (width - 1 - idx) and only move
+    // forward from one row to the next, so for the flip this is a sweep
+    // candidate to measure against BurstCoalesced rather than a default.
+    struct Prefetch {
+        using Load = lsu<prefetch<true>, statically_coalesce<false>>;
+        using Store = lsu<burst_coalesce<true>, statically_coalesce<false>>;
+        static constexpr const char *kLoadName = "prefetching";
+        static constexpr const char *kStoreName = "burst-coalesced";
+    };
+
+    // Every pixel is read exactly once, so a load cache is wasted area
+    struct CacheDisabled {
+        using Load = lsu<burst_coalesce<true>, cache<0>, statically_coalesce<false>>;
+        using Store = lsu<burst_coalesce<true>, statically_coalesce<false>>;
+        static constexpr const char *kLoadName = "burst-coalesced, cache disabled";
+        static constexpr const char *kStoreName = "burst-coalesced";
+    };
+} // namespace lsu_policy
+
+// PIPE DEFINITIONS
+template <int Lane>
+using ProducerToConsumerPipe = sycl::ext::intel::pipe<
+    ProducerConsumerPipe<Lane>,
+    uint64_t,
+    PIPE_DEPTH>;
+
+// Lane l owns rows [LaneRowBegin(l), LaneRowBegin(l + 1)) of the image
+constexpr size_t LaneRowBegin(size_t lane, size_t height) {
+    return (lane * height) / NUM_LANES;
+}
+
+// Producers read from the first channels, consumers write to the following
+// ones, wrapping around when there are more buffers than channels
+constexpr int ProducerMemChannel(size_t lane) {
+    return static_cast<int>(lane % kNumMemChannels) + 1;
+}
+
+constexpr int ConsumerMemChannel(size_t lane) {
+    return static_cast<int>((lane + NUM_LANES) % kNumMemChannels) + 1;
+}
+
+// The composite overlay takes the channel after the last consumer
+constexpr int OverlayMemChannel(void) {
+    return static_cast<int>((2 * NUM_LANES) % kNumMemChannels) + 1;
+}
+
+// kFixedWidth/kFixedHeight of 0 take the dimensions from the specialization
+// constants, otherwise the shape is baked in and the loop trip counts and the
+// idx bound check fold away at compile time.
+template <int Lane, size_t kFixedWidth = 0, size_t kFixedHeight = 0, typename Lsu = lsu_policy::LSU_POLICY>
+sycl::event Producer(sycl::queue &q, sycl::buffer<uint64_t, 1> &a_buf, size_t width, size_t height) {
+
+    auto e = q.submit([&](sycl::handler &h) {
+
+        sycl::accessor a(a_buf, h, sycl::read_only);
+
+        if constexpr (kFixedWidth == 0 || kFixedHeight == 0) {
+            h.set_specialization_constant<kWidthSpec>(width);
+            h.set_specialization_constant<kHeightSpec>(height);
+        }
+
+        h.single_task<ProducerKernel<Lane, kFixedWidth, kFixedHeight>>(
+            [=](sycl::kernel_handler kh) [[intel::kernel_args_restrict]] {
+
+            const size_t width = kFixedWidth != 0 ? kFixedWidth : kh.get_specialization_constant<kWidthSpec>();
+            const size_t height = kFixedHeight != 0 ? kFixedHeight : kh.get_specialization_constant<kHeightSpec>();
+            const size_t iters_per_row = (width / ELEMENTS_PER_DDR_ACCESS) + ((width % ELEMENTS_PER_DDR_ACCESS == 0) ? 0 : 1);
+            auto a_ptr = a.template get_multi_ptr<sycl::access::decorated::no>();
+
+            [[intel::loop_coalesce(LOOP_COALESCE)]]
+            for (size_t i = 0; i < height; i++) { // for each row
+                for (size_t j = 0; j < iters_per_row; j++) {
+                    #pragma unroll UNROLL_FACTOR
+                    for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
+                        size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
+                        if (idx < width) {
+                            ProducerToConsumerPipe<Lane>::write(Lsu::Load::load(a_ptr + (i * width) + (width - 1) - idx));
+                        }
+                    }
+                }
+            }
+        });
+    });
+
+    return e;
+}
+
+template <int Lane, size_t kFixedWidth = 0, size_t kFixedHeight = 0, typename Lsu = lsu_policy::LSU_POLICY>
+sycl::event Consumer(sycl::queue &q, sycl::buffer<uint64_t, 1> &b_buf, size_t width, size_t height) {
+
+    auto e = q.submit([&](sycl::handler &h) {
+
+        sycl::accessor b(b_buf, h, sycl::write_only, sycl::no_init);
+
+        if constexpr (kFixedWidth == 0 || kFixedHeight == 0) {
+            h.set_specialization_constant<kWidthSpec>(width);
+            h.set_specialization_constant<kHeightSpec>(height);
+        }
+
+        h.single_task<ConsumerKernel<Lane, kFixedWidth, kFixedHeight>>(
+            [=](sycl::kernel_handler kh) [[intel::kernel_args_restrict]] {
+
+            const size_t width = kFixedWidth != 0 ? kFixedWidth : kh.get_specialization_constant<kWidthSpec>();
+            const size_t height = kFixedHeight != 0 ? kFixedHeight : kh.get_specialization_constant<kHeightSpec>();
+            const size_t iters_per_row = (width / ELEMENTS_PER_DDR_ACCESS) + ((width % ELEMENTS_PER_DDR_ACCESS == 0) ? 0 : 1);
+            auto b_ptr = b.template get_multi_ptr<sycl::access::decorated::no>();
+
+            [[intel::loop_coalesce(LOOP_COALESCE)]]
+                for (size_t i = 0; i < height; i++) { // for each row
+                    for (size_t j = 0; j < iters_per_row; j++) {
+                        #pragma unroll UNROLL_FACTOR
+                        for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
+                            size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
+                            if (idx < width) {
+                                Lsu::Store::store(b_ptr + (i * width) + idx, ProducerToConsumerPipe<Lane>::read());
+                            }
+                        }
+                    }
+                }
+        });
+    });
+
+    return e;
+}
+
+// Each kernel of a lane gets its own --trace track, so the overlap of the
+// producers and consumers, and any stall between them, shows up directly.
+// The bytes each kernel moves give -p the bandwidth of every lane.
+inline void TraceLane(int lane, const sycl::event &producer, uint64_t producer_bytes,
+                      const sycl::event &consumer, uint64_t consumer_bytes) {
+    if (!perf::TraceEnabled())
+        return;
+    perf::TraceEvent(producer, "lane " + std::to_string(lane) + " producer", "producer", producer_bytes);
+    perf::TraceEvent(consumer, "lane " + std::to_string(lane) + " consumer", "consumer", consumer_bytes);
+}
+
+// Launch the producer/consumer pair of one lane. A fixed kHeight is split
+// between the lanes the same way as the runtime height.
+template <int Lane, size_t kFixedWidth, size_t kFixedHeight>
+void LaunchLane(sycl::queue &q,
+                sycl::buffer<uint64_t, 1> &producer_buffer, sycl::buffer<uint64_t, 1> &consumer_buffer,
+                size_t width, size_t height) {
+    constexpr size_t kFixedLaneHeight = LaneRowBegin(Lane + 1, kFixedHeight) - LaneRowBegin(Lane, kFixedHeight);
+    size_t lane_height = LaneRowBegin(Lane + 1, height) - LaneRowBegin(Lane, height);
+    sycl::event producer = Producer<Lane, kFixedWidth, kFixedLaneHeight>(q, producer_buffer, width, lane_height);
+    sycl::event consumer = Consumer<Lane, kFixedWidth, kFixedLaneHeight>(q, consumer_buffer, width, lane_height);
+    uint64_t band_bytes = lane_height * width * sizeof(uint64_t);
+    TraceLane(Lane, producer, band_bytes, consumer, band_bytes);
+}
+
+template <size_t kFixedWidth, size_t kFixedHeight, size_t... Lanes>
+void LaunchFlip(sycl::queue &q,
+                std::vector<sycl::buffer<uint64_t, 1>> &producer_buffers,
+                std::vector<sycl::buffer<uint64_t, 1>> &consumer_buffers,
+                size_t width, size_t height, std::index_sequence<Lanes...>) {
+    (LaunchLane<Lanes, kFixedWidth, kFixedHeight>(q, producer_buffers[Lanes], consumer_buffers[Lanes],
+                                                  width, height), ...);
+}
+
+// Run the flip with constexpr dimensions if the image matches one of the
+// HOT_SHAPES compiled in, otherwise with the specialization constant kernels.
+inline void Flip(sycl::queue &q,
+          std::vector<sycl::buffer<uint64_t, 1>> &producer_buffers,
+          std::vector<sycl::buffer<uint64_t, 1>> &consumer_buffers,
+          size_t width, size_t height) {
+#define HOT_SHAPE(w, h)                                                         \
+    if (width == (w) && height == (h)) {                                        \
+        LaunchFlip<(w), (h)>(q, producer_buffers, consumer_buffers,             \
+                             width, height, std::make_index_sequence<NUM_LANES>()); \
+        return;                                                                 \
+    }
+    HOT_SHAPES
+#undef HOT_SHAPE
+
+    LaunchFlip<0, 0>(q, producer_buffers, consumer_buffers,
+                     width, height, std::make_index_sequence<NUM_LANES>());
+}
+
+// COMPOSITING
+// Porter-Duff "over" on packed r << 48 | g << 32 | b << 16 | a pixels in
+// premultiplied 16-bit fixed point, where 0xFFFF is 1.0.
+
+// x * y / 0xFFFF, rounded, without a divide
+inline uint32_t MulUnit16(uint32_t x, uint32_t y) {
+    uint32_t t = x * y + 0x8000;
+    return (t + (t >> 16)) >> 16;
+}
+
+inline uint32_t Channel16(uint64_t pixel, int shift) {
+    return static_cast<uint32_t>(pixel >> shift) & 0xFFFF;
+}
+
+// Scale the color channels by alpha. Done once on the host for the overlay,
+// and in the kernel for each base pixel.
+inline uint64_t Premultiply(uint64_t pixel) {
+    uint32_t a = Channel16(pixel, 0);
+    return static_cast<uint64_t>(MulUnit16(Channel16(pixel, 48), a)) << 48 |
+           static_cast<uint64_t>(MulUnit16(Channel16(pixel, 32), a)) << 32 |
+           static_cast<uint64_t>(MulUnit16(Channel16(pixel, 16), a)) << 16 | a;
+}
+
+// Back to straight alpha for the PNG writer, host only
+inline uint64_t Unpremultiply(uint64_t pixel) {
+    uint64_t a = Channel16(pixel, 0);
+    uint64_t out = a;
+    for (int shift = 16; shift <= 48; shift += 16) {
+        uint64_t c = a == 0 ? 0 : (Channel16(pixel, shift) * 0xFFFF + a / 2) / a;
+        out |= std::min<uint64_t>(c, 0xFFFF) << shift;
+    }
+    return out;
+}
+
+// src over dst, both premultiplied: out = src + dst * (1 - src_alpha)
+inline uint64_t Over(uint64_t src, uint64_t dst) {
+    uint32_t inv = 0xFFFF - Channel16(src, 0);
+    uint64_t out = 0;
+    for (int shift = 0; shift <= 48; shift += 16) {
+        uint32_t c = Channel16(src, shift) + MulUnit16(Channel16(dst, shift), inv);
+        out |= static_cast<uint64_t>(c > 0xFFFF ? 0xFFFF : c) << shift;
+    }
+    return out;
+}
+
+// Like Producer, but each base pixel is composited under the overlay before
+// it goes down the pipe, so the consumers are shared with the flip. The
+// overlay is premultiplied and either the size of the image or, with kTile,
+// repeated across it. row_offset is the lane's first row in the full image.
+template <int Lane, bool kTile, typename Lsu = lsu_policy::LSU_POLICY>
+sycl::event CompositeProducer(sycl::queue &q, sycl::buffer<uint64_t, 1> &a_buf, sycl::buffer<uint64_t, 1> &overlay_buf,
+                              size_t width, size_t height, size_t row_offset,
+                              size_t overlay_width, size_t overlay_height) {
+
+    auto e = q.submit([&](sycl::handler &h) {
+
+        sycl::accessor a(a_buf, h, sycl::read_only);
+        sycl::accessor overlay(overlay_buf, h, sycl::read_only);
+
+        h.set_specialization_constant<kWidthSpec>(width);
+        h.set_specialization_constant<kHeightSpec>(height);
+
+        h.single_task<CompositeKernel<Lane, kTile>>(
+            [=](sycl::kernel_handler kh) [[intel::kernel_args_restrict]] {
+
+            const size_t width = kh.get_specialization_constant<kWidthSpec>();
+            const size_t height = kh.get_specialization_constant<kHeightSpec>();
+            const size_t iters_per_row = (width / ELEMENTS_PER_DDR_ACCESS) + ((width % ELEMENTS_PER_DDR_ACCESS == 0) ? 0 : 1);
+            auto a_ptr = a.template get_multi_ptr<sycl::access::decorated::no>();
+            auto overlay_ptr = overlay.template get_multi_ptr<sycl::access::decorated::no>();
+
+            [[intel::loop_coalesce(LOOP_COALESCE)]]
+            for (size_t i = 0; i < height; i++) { // for each row
+                for (size_t j = 0; j < iters_per_row; j++) {
+                    #pragma unroll UNROLL_FACTOR
+                    for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
+                        size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
+                        if (idx < width) {
+                            size_t overlay_idx = kTile
+                                ? ((row_offset + i) % overlay_height) * overlay_width + (idx % overlay_width)
+                                : (row_offset + i) * width + idx;
+                            uint64_t base = Premultiply(Lsu::Load::load(a_ptr + (i * width) + idx));
+                            uint64_t top = Lsu::Load::load(overlay_ptr + overlay_idx);
+                            ProducerToConsumerPipe<Lane>::write(Over(top, base));
+                        }
+                    }
+                }
+            }
+        });
+    });
+
+    return e;
+}
+
+template <int Lane, bool kTile>
+void CompositeLane(sycl::queue &q,
+                   sycl::buffer<uint64_t, 1> &producer_buffer, sycl::buffer<uint64_t, 1> &overlay_buffer,
+                   sycl::buffer<uint64_t, 1> &consumer_buffer,
+                   size_t width, size_t height, size_t overlay_width, size_t overlay_height) {
+    size_t lane_height = LaneRowBegin(Lane + 1, height) - LaneRowBegin(Lane, height);
+    sycl::event producer = CompositeProducer<Lane, kTile>(q, producer_buffer, overlay_buffer, width, lane_height,
+                                                          LaneRowBegin(Lane, height), overlay_width, overlay_height);
+    sycl::event consumer = Consumer<Lane>(q, consumer_buffer, width, lane_height);
+    // The producer reads a base and an overlay pixel for every output pixel
+    uint64_t band_bytes = lane_height * width * sizeof(uint64_t);
+    TraceLane(Lane, producer, 2 * band_bytes, consumer, band_bytes);
+}
+
+template <bool kTile, size_t... Lanes>
+void LaunchComposite(sycl::queue &q,
+                     std::vector<sycl::buffer<uint64_t, 1>> &producer_buffers,
+                     sycl::buffer<uint64_t, 1> &overlay_buffer,
+                     std::vector<sycl::buffer<uint64_t, 1>> &consumer_buffers,
+                     size_t width, size_t height, size_t overlay_width, size_t overlay_height,
+                     std::index_sequence<Lanes...>) {
+    (CompositeLane<Lanes, kTile>(q, producer_buffers[Lanes], overlay_buffer, consumer_buffers[Lanes],
+                                 width, height, overlay_width, overlay_height), ...);
+}
+
+// Composite the overlay over the image on every lane. All lanes read the one
+// overlay buffer, which stays on the device between calls.
+inline void Composite(sycl::queue &q,
+               std::vector<sycl::buffer<uint64_t, 1>> &producer_buffers,
+               sycl::buffer<uint64_t, 1> &overlay_buffer,
+               std::vector<sycl::buffer<uint64_t, 1>> &consumer_buffers,
+               size_t width, size_t height, size_t overlay_width, size_t overlay_height) {
+    if (overlay_width == width && overlay_height == height)
+        LaunchComposite<false>(q, producer_buffers, overlay_buffer, consumer_buffers,
+                               width, height, overlay_width, overlay_height, std::make_index_sequence<NUM_LANES>());
+    else
+        LaunchComposite<true>(q, producer_buffers, overlay_buffer, consumer_buffers,
+                              width, height, overlay_width, overlay_height, std::make_index_sequence<NUM_LANES>());
+}
+
+// --verify: every lane's output band against a host reference of the
+// command, so a producer or consumer that gets its index math wrong for
+// some width or lane split shows up with the row and column it broke at.
+// overlay is premultiplied, as the kernels get it.
+inline bool VerifyLanes(const std::string &command, const std::vector<Matrix<uint64_t>> &in_lanes,
+                 const std::vector<Matrix<uint64_t>> &out_lanes, const Matrix<uint64_t> &overlay,
+                 size_t width, size_t height) {
+    PERF_ZONE("verify");
+    size_t bands = 0;
+    for (size_t lane = 0; lane < NUM_LANES; lane++) {
+        size_t first_row = LaneRowBegin(lane, height);
+        const Matrix<uint64_t> &in = in_lanes[lane];
+        verify::Result<uint64_t> result = verify::Check(out_lanes[lane].data(), width, in.rows(),
+            [&](size_t first, size_t rows, uint64_t *out) {
+                for (size_t i = 0; i < rows; i++) {
+                    const uint64_t *src = in.data() + (first + i) * width;
+                    uint64_t *dst = out + i * width;
+                    size_t image_row = first_row + first + i;
+                    for (size_t j = 0; j < width; j++) {
+                        if (command == "flip")
+                            dst[j] = src[width - 1 - j];
+                        else
+                            dst[j] = Over(overlay(image_row % overlay.rows(), j % overlay.cols()), Premultiply(src[j]));
+                    }
+                }
+            });
+        bands += result.bands;
+        if (!result.ok) {
+            std::cerr << "Verification failed in lane " << lane << ", first difference at row " << first_row + result.row
+                      << ", column " << result.col << ": expected 0x" << std::hex << result.expected
+                      << ", got 0x" << result.actual << std::dec << std::endl;
+            return false;
+        }
+    }
+    std::cout << "Verified " << width << "x" << height << " output of " << NUM_LANES
+              << " lanes against the host reference in " << bands << " bands\n";
+    return true;
+}
+
+// What a run keeps on the device from one job to the next: the queue, the
+// lane buffers of the last image shape and the last overlay. use_host_ptr
+// makes every lane's Matrix its buffer's host memory, so host accessors
+// move the bands in and out in place. Under --serve a job of the same shape
+// then only pays for its kernels and the transfers.
+struct Session {
+    explicit Session(sycl::queue &queue) : q(queue) {}
+
+    sycl::queue &q;
+    size_t width = 0;
+    size_t height = 0;
+    size_t pixels = 0;                  // Over every job, for the per pixel counters
+    std::vector<Matrix<uint64_t>> in_lanes = std::vector<Matrix<uint64_t>>(NUM_LANES);
+    std::vector<Matrix<uint64_t>> out_lanes = std::vector<Matrix<uint64_t>>(NUM_LANES);
+    std::vector<sycl::buffer<uint64_t, 1>> producer_buffers;
+    std::vector<sycl::buffer<uint64_t, 1>> consumer_buffers;
+    // Premultiplied overlay, kept while its file is unchanged
+    std::string overlay_path;
+    struct timespec overlay_mtime = {};
+    Matrix<uint64_t> overlay;
+    std::optional<sycl::buffer<uint64_t, 1>> overlay_buffer;
+};
+
+// Lane buffers for a width x height image, only rebuilt when the shape changes
+inline void Fit(Session &s, size_t width, size_t height) {
+    if(!s.producer_buffers.empty() && s.width == width && s.height == height)
+        return;
+    PERF_ZONE("buffer construction");
+    s.producer_buffers.clear();
+    s.consumer_buffers.clear();
+    for (size_t lane = 0; lane < NUM_LANES; lane++) {
+        size_t band_rows = LaneRowBegin(lane + 1, height) - LaneRowBegin(lane, height);
+        s.in_lanes[lane].resize(band_rows, width);
+        s.out_lanes[lane].resize(band_rows, width);
+        s.producer_buffers.push_back(MakeBuffer(s.in_lanes[lane], sycl::property::buffer::mem_channel{ProducerMemChannel(lane)}));
+        s.consumer_buffers.push_back(MakeBuffer(s.out_lanes[lane], sycl::property::buffer::mem_channel{ConsumerMemChannel(lane)}));
+    }
+    s.width = width;
+    s.height = height;
+}
+
+// Decode and premultiply the overlay name, a PNG in ../in, into s, unless it
+// is the one already there, and check it against the width x height image.
+// broadcast allows a smaller overlay, tiled.
+inline bool LoadOverlay(Session &s, const std::string &name, bool broadcast, size_t width, size_t height,
+                        std::string &error) {
+    std::string path = "../in/" + name;
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) {
+        error = "Could not open '" + path + "'";
+        return false;
+    }
+    if(!s.overlay_buffer || path != s.overlay_path || st.st_mtim.tv_sec != s.overlay_mtime.tv_sec ||
+       st.st_mtim.tv_nsec != s.overlay_mtime.tv_nsec) {
+        perf::ScopedZone decode("PNG decode");
+        img::PNG overlay_png(path);
+        decode.End();
+        img::PNG_PIXEL_RGBA_16_ROWS overlay;
+        {
+            PERF_ZONE("asRGBA16");
+            overlay = overlay_png.asRGBA16();
+        }
+        // Premultiplied once here rather than per frame in the kernel
+        PERF_ZONE("premultiply overlay");
+        s.overlay_buffer.reset();
+        s.overlay.resize(overlay.size(), overlay[0].size());
+        for (size_t i = 0; i < s.overlay.rows(); i++) {
+            auto dst = s.overlay.row(i);
+            for (size_t j = 0; j < s.overlay.cols(); j++) {
+                auto pixel = overlay[i][j];
+                if(overlay_png.channels() != 4)
+                    pixel.rgba.a = 0xFFFF;
+                dst[j] = Premultiply(static_cast<uint64_t>(pixel));
+            }
+        }
+        // Uploaded on the first repetition, then reused by every later one
+        s.overlay_buffer.emplace(MakeBuffer(s.overlay, sycl::property::buffer::mem_channel{OverlayMemChannel()}));
+        s.overlay_path = path;
+        s.overlay_mtime = st.st_mtim;
+    }
+    size_t overlay_width = s.overlay.cols();
+    size_t overlay_height = s.overlay.rows();
+    if((overlay_width != width || overlay_height != height) && !broadcast) {
+        error = "Overlay is " + std::to_string(overlay_width) + "x" + std::to_string(overlay_height) + ", image is " +
+                std::to_string(width) + "x" + std::to_string(height) + ", use --broadcast to tile a smaller overlay";
+        return false;
+    }
+    if(overlay_width > width || overlay_height > height) {
+        error = "Overlay is larger than the image";
+        return false;
+    }
+    return true;
+}
+
+// Pack rows into each lane's band, with the alpha made opaque if opaque is
+// set. The host accessors tell the runtime the bands changed since the last
+// run.
+inline void FlattenLanes(Session &s, const img::PNG_PIXEL_RGBA_16_ROWS &rows, bool opaque) {
+    for (size_t lane = 0; lane < NUM_LANES; lane++) {
+        size_t first_row = LaneRowBegin(lane, s.height);
+        sycl::host_accessor band(s.producer_buffers[lane], sycl::write_only, sycl::no_init);
+        for (size_t i = 0; i < s.in_lanes[lane].rows(); i++) {
+            uint64_t *dst = band.get_pointer() + i * s.width;
+            for (size_t j = 0; j < s.width; j++) {
+                dst[j] = static_cast<uint64_t>(rows[first_row + i][j]);
+                if(opaque)
+                    dst[j] |= 0xFFFF;
+            }
+        }
+    }
+}
+
+// A host accessor on every consumer buffer brings its band back into
+// out_lanes, where it stays until the next run's kernels
+inline void WritebackLanes(Session &s) {
+    std::vector<sycl::host_accessor<uint64_t, 1, sycl::access_mode::read>> results;
+    for (auto &buffer : s.consumer_buffers)
+        results.emplace_back(buffer, sycl::read_only);
+}
+
+// Every lane's output band into rows, which are the size of the image.
+// unpremultiply undoes composite's premultiplied alpha.
+inline void UnflattenLanes(const Session &s, img::PNG_PIXEL_RGBA_16_ROWS &rows, bool unpremultiply) {
+    for (size_t lane = 0; lane < NUM_LANES; lane++) {
+        size_t first_row = LaneRowBegin(lane, s.height);
+        for (size_t i = first_row; i < LaneRowBegin(lane + 1, s.height); i++) {
+            auto src = s.out_lanes[lane].row(i - first_row);
+            for (size_t j = 0; j < s.width; j++) {
+                uint64_t val = unpremultiply ? Unpremultiply(src[j]) : src[j];
+                rows[i][j].rgba.r = (uint16_t)(val >> 48);
+                rows[i][j].rgba.g = (uint16_t)(val >> 32);
+                rows[i][j].rgba.b = (uint16_t)(val >> 16);
+                rows[i][j].rgba.a = (uint16_t)val;
+            }
+        }
+    }
+}
+
+#endif // LANES_HPP__
@@ -0,0 +1,278 @@
+// Serve.hpp
+//
+// What the --serve daemon and accelerator-client share: the Unix domain
+// socket jobs arrive on, and images in POSIX shared memory, which let a
+// frame reach the daemon and come back without a PNG in between.
+//
+// A client connects, sends the job's arguments, as on the command line, one
+// per line, then an empty line, and reads one line back: "ok <milliseconds>"
+// or "error <message>". A job of just "stop" shuts the daemon down.
+//
+// A shared memory image, "shm:<name>" wherever a file name goes, is a
+// SharedImage::Header followed by width x height pixels, row-major, each one
+// packed as r << 48 | g << 32 | b << 16 | a, 16 bits a channel, which is how
+// the lanes take them.
+//
+
+#ifndef SERVE_HPP__
+#define SERVE_HPP__
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+namespace serve {
+
+constexpr const char *kDefaultSocket = "/tmp/accelerator.sock";
+constexpr const char *kShmPrefix = "shm:";
+constexpr size_t kMaxRequestBytes = 64 << 10;	// Far more than any job's arguments
+constexpr int kRequestTimeoutSeconds = 5;	// To send a request, once connected
+
+inline bool IsShm(const std::string &name) {
+	return name.compare(0, strlen(kShmPrefix), kShmPrefix) == 0;
+}
+
+// A client's PNG names stay inside ../in and ../out: no '/' and no ".."
+inline bool IsPlainName(const std::string &name) {
+	return name.find('/') == std::string::npos && name.find("..") == std::string::npos;
+}
+
+// shm_open name of "shm:<name>", which wants a leading '/'
+inline std::string ShmName(const std::string &name) {
+	std::string shm_name = name.substr(strlen(kShmPrefix));
+	return shm_name[0] == '/' ? shm_name : "/" + shm_name;
+}
+
+// An image in shared memory, mapped read/write until destruction
+class SharedImage {
+public:
+	static constexpr uint64_t kMagic = 0x31474d4943434153ull;	// "SACCIMG1"
+
+	struct Header {
+		uint64_t magic;
+		uint64_t width;
+		uint64_t height;
+	};
+
+	SharedImage(void) = default;
+	SharedImage(const SharedImage &) = delete;
+	SharedImage &operator=(const SharedImage &) = delete;
+
+	~SharedImage(void) {
+		if(m_header != nullptr)
+			munmap(m_header, m_size);
+	}
+
+	// Map the existing image name ("shm:<name>")
+	bool Open(const std::string &name, std::string &error) {
+		int fd = shm_open(ShmName(name).c_str(), O_RDWR, 0);
+		if(fd < 0)
+			return Fail(name, "could not be opened", error);
+		struct stat st;
+		bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header) && Map(fd, st.st_size);
+		close(fd);
+		if(!ok)
+			return Fail(name, "could not be mapped", error);
+		if(m_header->magic != kMagic || !Fits(m_header->width, m_header->height, m_size))
+			return Fail(name, "is not an image", error);
+		return true;
+	}
+
+	// Create name, or resize it, to hold a width x height image
+	bool Create(const std::string &name, size_t width, size_t height, std::string &error) {
+		if(!Fits(width, height, SIZE_MAX))
+			return Fail(name, "cannot hold the image", error);
+		int fd = shm_open(ShmName(name).c_str(), O_RDWR | O_CREAT, 0600);
+		if(fd < 0)
+			return Fail(name, "could not be created", error);
+		bool ok = ftruncate(fd, Bytes(width, height)) == 0 && Map(fd, Bytes(width, height));
+		close(fd);
+		if(!ok)
+			return Fail(name, "could not be mapped", error);
+		m_header->magic = kMagic;
+		m_header->width = width;
+		m_header->height = height;
+		return true;
+	}
+
+	size_t width(void) const { return m_header->width; }
+	size_t height(void) const { return m_header->height; }
+	uint64_t *data(void) { return reinterpret_cast<uint64_t *>(m_header + 1); }
+	const uint64_t *data(void) const { return reinterpret_cast<const uint64_t *>(m_header + 1); }
+
+	// Header and pixels, only for a shape that Fits
+	static size_t Bytes(size_t width, size_t height) {
+		return sizeof(Header) + width * height * sizeof(uint64_t);
+	}
+
+	// Whether a width x height image, header included, fits in size bytes.
+	// Divides rather than multiplies, so a forged header cannot wrap around.
+	static bool Fits(size_t width, size_t height, size_t size) {
+		if(width == 0 || height == 0 || size < sizeof(Header))
+			return false;
+		return width <= (size - sizeof(Header)) / sizeof(uint64_t) / height;
+	}
+
+private:
+	bool Map(int fd, size_t size) {
+		void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(ptr == MAP_FAILED)
+			return false;
+		m_header = static_cast<Header *>(ptr);
+		m_size = size;
+		return true;
+	}
+
+	static bool Fail(const std::string &name, const char *what, std::string &error) {
+		error = "Shared memory image '" + name + "' " + what;
+		return false;
+	}
+
+	Header *m_header = nullptr;
+	size_t m_size = 0;
+};
+
+inline bool SocketAddress(const std::string &path, struct sockaddr_un &addr, std::string &error) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)) {
+		error = "Socket path '" + path + "' is too long";
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	return true;
+}
+
+// Listening socket at path, replacing a stale one. -1 and error on failure,
+// also if path is not a socket or a daemon still accepts on it.
+inline int Listen(const std::string &path, std::string &error) {
+	struct sockaddr_un addr;
+	if(!SocketAddress(path, addr, error))
+		return -1;
+	struct stat st;
+	if(lstat(path.c_str(), &st) == 0) {
+		if(!S_ISSOCK(st.st_mode)) {
+			error = "'" + path + "' exists and is not a socket";
+			return -1;
+		}
+		// Only a socket nobody accepts on is stale
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool live = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+		if(probe >= 0)
+			close(probe);
+		if(live) {
+			error = "A daemon is already serving on '" + path + "'";
+			return -1;
+		}
+		unlink(path.c_str());
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		error = std::string("socket: ") + strerror(errno);
+		return -1;
+	}
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+		error = "Could not listen on '" + path + "': " + strerror(errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Connection to the daemon listening at path. -1 and error on failure.
+inline int Connect(const std::string &path, std::string &error) {
+	struct sockaddr_un addr;
+	if(!SocketAddress(path, addr, error))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		error = std::string("socket: ") + strerror(errno);
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		error = "Could not connect to '" + path + "': " + strerror(errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// All of text, without a SIGPIPE if the other side has gone
+inline bool SendAll(int fd, const std::string &text) {
+	size_t sent = 0;
+	while(sent < text.size()) {
+		ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+
+// Lines of a socket, read a block at a time
+class LineReader {
+public:
+	explicit LineReader(int fd) : m_fd(fd) {}
+
+	// Next line without its '\n'. False at the end of the stream, on an error
+	// or past kMaxRequestBytes.
+	bool Next(std::string &line) {
+		for(;;) {
+			size_t end = m_buffer.find('\n', m_pos);
+			if(end != std::string::npos) {
+				line.assign(m_buffer, m_pos, end - m_pos);
+				m_pos = end + 1;
+				return true;
+			}
+			if(m_buffer.size() > kMaxRequestBytes)
+				return false;
+			char block[4096];
+			ssize_t n = read(m_fd, block, sizeof(block));
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			m_buffer.append(block, n);
+		}
+	}
+
+private:
+	int m_fd;
+	std::string m_buffer;
+	size_t m_pos = 0;
+};
+
+inline bool SendRequest(int fd, const std::vector<std::string> &args) {
+	std::string text;
+	for (auto &arg : args)
+		text += arg + "\n";
+	return SendAll(fd, text + "\n");
+}
+
+inline bool ReceiveRequest(int fd, std::vector<std::string> &args) {
+	LineReader reader(fd);
+	std::string line;
+	args.clear();
+	while(reader.Next(line)) {
+		if(line.empty())
+			return !args.empty();
+		args.push_back(line);
+	}
+	return false;
+}
+
+} // namespace serve
+
+#endif // SERVE_HPP__
@@ -0,0 +1,120 @@
+# Runs every sweep variant on every sweep image and writes one results table.
+# Invoked by the sweep target, see SECTION 3 of CMakeLists.txt.
+#
+#    cmake -DSWEEP_CONFIG=<sweep_variants.cmake> -DSWEEP_BINARY_DIR=<dir>
+#          -DSWEEP_RESULTS=<sweep_results.md> -P sweep.cmake
+
+include(${SWEEP_CONFIG})
+
+# "12.345" or "1.2345e+01" milliseconds -> 12345 microseconds, as iostream
+# prints a double; math() only handles integers, so the decimal point is
+# moved in the digit string
+function(to_microseconds MS OUT)
+    string(REGEX MATCH "^([0-9]+)(\\.([0-9]*))?([eE]\\+?(-?[0-9]+))?" _ "${MS}")
+    set(DIGITS "${CMAKE_MATCH_1}${CMAKE_MATCH_3}")
+    set(EXPONENT "${CMAKE_MATCH_5}")
+    string(LENGTH "${CMAKE_MATCH_1}" POINT)
+    if(EXPONENT STREQUAL "")
+        set(EXPONENT 0)
+    endif()
+    math(EXPR POINT "${POINT} + ${EXPONENT} + 3")
+    string(LENGTH "${DIGITS}" LENGTH)
+    if(POINT LESS_EQUAL 0)
+        set(US 0)
+    else()
+        while(LENGTH LESS POINT)
+            string(APPEND DIGITS "0")
+            math(EXPR LENGTH "${LENGTH} + 1")
+        endwhile()
+        string(SUBSTRING "${DIGITS}" 0 ${POINT} US)
+        math(EXPR US "${US}")
+    endif()
+    set(${OUT} ${US} PARENT_SCOPE)
+endfunction()
+
+function(to_milliseconds US OUT)
+    math(EXPR WHOLE "${US} / 1000")
+    math(EXPR FRACTION "${US} % 1000 + 1000")
+    string(SUBSTRING "${FRACTION}" 1 3 FRACTION)
+    set(${OUT} "${WHOLE}.${FRACTION}" PARENT_SCOPE)
+endfunction()
+
+set(TABLE "| elements_per_ddr_access | loop_coalesce | unroll | pipe_depth | lanes | lsu_policy |")
+set(RULE "|---|---|---|---|---|---|")
+foreach(IMAGE ${SWEEP_IMAGES})
+    string(APPEND TABLE " ${IMAGE} (ms) |")
+    string(APPEND RULE "---|")
+endforeach()
+string(APPEND TABLE " total (ms) |\n${RULE}---|\n")
+
+set(BEST_US "")
+set(BEST_VARIANT "")
+foreach(VARIANT ${SWEEP_VARIANTS})
+    string(REPLACE "|" ";" FIELDS "${VARIANT}")
+    list(GET FIELDS 0 BINARY)
+    list(GET FIELDS 1 ELEMENTS)
+    list(GET FIELDS 2 COALESCE)
+    list(GET FIELDS 3 UNROLL)
+    list(GET FIELDS 4 DEPTH)
+    list(GET FIELDS 5 LANES)
+    list(GET FIELDS 6 POLICY)
+
+    set(ROW "| ${ELEMENTS} | ${COALESCE} | ${UNROLL} | ${DEPTH} | ${LANES} | ${POLICY} |")
+    set(TOTAL_US 0)
+    set(FAILED FALSE)
+    foreach(IMAGE ${SWEEP_IMAGES})
+        set(SAMPLES "")
+        foreach(RUN RANGE 1 ${SWEEP_RUNS})
+            execute_process(
+                COMMAND ${SWEEP_BINARY_DIR}/${BINARY} flip -in=${IMAGE} -out=${IMAGE} ${SWEEP_REPETITIONS}
+                OUTPUT_VARIABLE OUTPUT
+                ERROR_VARIABLE OUTPUT
+                RESULT_VARIABLE RESULT)
+            if(NOT RESULT EQUAL 0 OR NOT OUTPUT MATCHES "Computation was ([0-9.eE+-]+) milliseconds")
+                message(WARNING "${BINARY} failed on ${IMAGE}:\n${OUTPUT}")
+                set(FAILED TRUE)
+                break()
+            endif()
+            to_microseconds(${CMAKE_MATCH_1} US)
+            list(APPEND SAMPLES ${US})
+        endforeach()
+        if(FAILED)
+            break()
+        endif()
+
+        list(SORT SAMPLES COMPARE NATURAL)
+        list(LENGTH SAMPLES COUNT)
+        math(EXPR MIDDLE "${COUNT} / 2")
+        list(GET SAMPLES ${MIDDLE} MEDIAN_US)
+        math(EXPR TOTAL_US "${TOTAL_US} + ${MEDIAN_US}")
+        to_milliseconds(${MEDIAN_US} MEDIAN_MS)
+        string(APPEND ROW " ${MEDIAN_MS} |")
+        message(STATUS "${BINARY} ${IMAGE}: ${MEDIAN_MS} ms")
+    endforeach()
+
+    if(FAILED)
+        string(APPEND TABLE "${ROW} failed |\n")
+        continue()
+    endif()
+
+    to_milliseconds(${TOTAL_US} TOTAL_MS)
+    string(APPEND TABLE "${ROW} ${TOTAL_MS} |\n")
+    if(BEST_US STREQUAL "" OR TOTAL_US LESS BEST_US)
+        set(BEST_US ${TOTAL_US})
+        set(BEST_VARIANT "ELEMENTS_PER_DDR_ACCESS=${ELEMENTS} LOOP_COALESCE=${COALESCE} UNROLL_FACTOR=${UNROLL} PIPE_DEPTH=${DEPTH} NUM_LANES=${LANES} LSU_POLICY=${POLICY}")
+    endif()
+endforeach()
+
+if(BEST_VARIANT STREQUAL "")
+    set(BEST "No configuration completed")
+else()
+    to_milliseconds(${BEST_US} BEST_MS)
+    set(BEST "Best configuration: ${BEST_VARIANT} (${BEST_MS} ms total)")
+endif()
+
+file(WRITE ${SWEEP_RESULTS}
+    "# Sweep results\n\n"
+    "Median of ${SWEEP_RUNS} runs, ${SWEEP_REPETITIONS} repetitions each.\n\n"
+    "${TABLE}\n${BEST}\n")
+message(STATUS "${BEST}")
+message(STATUS "Results written to ${SWEEP_RESULTS}")
@@ -7,7 +7,6 @@
 #include "PngImage.hpp"
 
 //using namespace sycl;			// SYCL namespace
-typedef std::vector<std::vector<int>> Vector2D;
 
 ////////////////////////////////////////////////////////////////////////////////
 // UTILS
@@ -37,12 +36,29 @@ void Help(void) {
 	// Command line arguments.
 	// accelerator [command] -i=[input file] -o=[output file]
 	// -h, --help
-	// future options?
-	// -p,performance : output perf metrics
-	std::cout << "accelerator [command] -i=<input file> -o=<output file>\n";
+	// -p, --perf
+	std::cout << "accelerator [command] -i=<input file> -o=<output file> [options] <# repetitions>\n";
+	std::cout << "accelerator --serve[=<socket>] [options]\n";
 	std::cout << "  -h,--help                                : this help text\n";
+	std::cout << "  -p,--perf                                : print the time spent in each stage\n";
+	std::cout << "  --verify                                 : check every lane's output against a host reference\n";
+	std::cout << "  --mem                                    : -p plus the allocations and resident memory\n";
+	std::cout << "                                             of each stage\n";
+	std::cout << "  --counters                               : -p plus cycles, IPC and cache, dTLB and branch\n";
+	std::cout << "                                             misses of each stage (perf_event_open)\n";
+	std::cout << "  --peak-gbps=<n>                          : memory bandwidth -p compares kernels to\n";
+	std::cout << "                                             (default: 4 DDR4-2400 channels)\n";
+	std::cout << "  --trace=<file>                           : write host stages and every lane's kernels\n";
+	std::cout << "                                             as a Chrome trace, for Perfetto\n";
+	std::cout << "  -i2=<input file>                         : overlay of composite\n";
+	std::cout << "  --broadcast                              : tile an overlay smaller than the image\n";
+	std::cout << "  -i=shm:<name>, -o=shm:<name>             : packed image in shared memory, see Serve.hpp\n";
+	std::cout << "  --serve[=<socket>]                       : keep the device warm and run the jobs of\n";
+	std::cout << "                                             accelerator-client (default /tmp/accelerator.sock)\n";
+	std::cout << "  --warmup=<input file>                    : flip it once before serving\n";
 	std::cout << "  [command]                                                \n";
 	std::cout << "  	flip                             : flip vectors  \n";
+	std::cout << "  	composite                        : overlay -i2 over -i (Porter-Duff over)\n";
 }
 
 bool FindGetArg(std::string & arg,
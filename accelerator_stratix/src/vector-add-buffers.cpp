@@ -4,16 +4,23 @@
 #include <string>
 #include <cmath>
 #include <png.h>
+#include <utility>
+#include <optional>
 #if FPGA_HARDWARE || FPGA_EMULATOR || FPGA_SIMULATOR
 #include <sycl/ext/intel/fpga_extensions.hpp>
 #endif
 
-#include "io.hpp"
+#include "Matrix.hpp"
 #include "util.hpp"
 #include "PngImage.hpp"
+#include "Lanes.hpp"
+#include "Trace.hpp"
+#include "PerfAlloc.hpp"
+#include "Verify.hpp"
+#include "Serve.hpp"
 
 // DEFINITIONS //
-#define ELEMENTS_PER_DDR_ACCESS 16
+// Design parameters are in Lanes.hpp
 #ifdef __SYCL_DEVICE_ONLY__
   #define CL_CONSTANT __attribute__((opencl_constant))
 #else
@@ -25,145 +32,311 @@
 
 // GLOBAL VARIABLES //
 bool help = false;                      // If help message needs to print
+bool perf_report = false;               // Print the per stage timing table (-p, --perf)
+bool mem_report = false;                // Add each stage's memory to it (--mem)
+bool counter_report = false;            // and its hardware counters (--counters)
+bool verify_output = false;             // Check the output against the host (--verify)
 constexpr int kMaxStringLen = 40;       // Max filename string legth
-template <int N> class ProducerKernel1;  // Forward declare kernel name
-template <int N> class ProducerKernel2;  // Forward declare kernel name
-template <int N> class ConsumerKernel1;  // Forward declare kernel name
-template <int N> class ConsumerKernel2;  // Forward declare kernel name
-size_t num_repetitions = 1;             // Times to repeat kernel outer loop
-
-// PIPE DEFINITIONS
-using ProducerToConsumerPipe1 = sycl::ext::intel::pipe<
-    class ProducerConsumerPipe1,
-    uint64_t,
-    1000>;
-using ProducerToConsumerPipe2 = sycl::ext::intel::pipe<
-    class ProducerConsumerPipe2,
-    uint64_t,
-    1000>;
-
-sycl::event Producer1(sycl::queue &q, sycl::buffer<uint64_t, 1> &a_buf, size_t width, size_t height) {
-
-    auto e = q.submit([&](sycl::handler &h) {
-
-        sycl::accessor a(a_buf, h, sycl::read_only);
-
-        h.single_task<class ProducerKernel1<1>>(
-            [=]() [[intel::kernel_args_restrict]] {
-
-            size_t iters_per_row = (width / 16) + ((width % 16 == 0) ? 0 : 1);
-
-            [[intel::loop_coalesce(3)]]
-            for (size_t i = 0; i < height; i++) { // for each row
-                for (size_t j = 0; j < iters_per_row; j++) {
-                    #pragma unroll
-                    for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
-                        size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
-                        ProducerToConsumerPipe1::write(a[(i * width) + (width - 1) - idx]);
-                    }
-                }
-            }
-        });
-    });
 
-    return e;
+// JOBS
+// One run of a command, from the command line or a --serve request
+struct Job {
+    std::string command;
+    std::string infilename;             // PNG in ../in, or shm:<name>
+    std::string infilename2;            // Overlay of composite, a PNG in ../in
+    std::string outfilename;            // PNG in ../out, or shm:<name>, none to discard
+    long repetitions = 1;               // Times to repeat the kernels
+    bool broadcast = false;             // Tile a smaller overlay
+};
+
+// Take arg into job if it is one of its options or the command
+bool ParseJobArg(std::string sarg, Job &job) {
+    char value[kMaxStringLen] = {0};
+    if(sarg[0] != '-') {
+        job.command = sarg;
+    } else if(FindGetArgString(sarg, "-i=", value, kMaxStringLen) ||
+              FindGetArgString(sarg, "-in=", value, kMaxStringLen) ||
+              FindGetArgString(sarg, "--input-file=", value, kMaxStringLen)) {
+        job.infilename = value;
+    } else if(FindGetArgString(sarg, "-o=", value, kMaxStringLen) ||
+              FindGetArgString(sarg, "-out=", value, kMaxStringLen) ||
+              FindGetArgString(sarg, "--output-file=", value, kMaxStringLen)) {
+        job.outfilename = value;
+    } else if(FindGetArgString(sarg, "-i2=", value, kMaxStringLen) ||
+              FindGetArgString(sarg, "--input-file2=", value, kMaxStringLen)) {
+        job.infilename2 = value;
+    } else if(sarg == "--broadcast") {
+        job.broadcast = true;
+    } else {
+        return false;
+    }
+    return true;
 }
 
-sycl::event Producer2(sycl::queue &q, sycl::buffer<uint64_t, 1> &a_buf, size_t width, size_t height) {
-
-    auto e = q.submit([&](sycl::handler &h) {
+bool CheckJob(const Job &job, std::string &error) {
+    if(job.command != "flip" && job.command != "composite")
+        error = "Unknown command '" + job.command + "'";
+    else if(job.command == "composite" && job.infilename2.empty())
+        error = "Command 'composite' needs an overlay, -i2=<input file>";
+    else if(serve::IsShm(job.infilename2))
+        error = "The overlay of composite must be a PNG";
+    else if(serve::IsShm(job.infilename) && !job.outfilename.empty() && !serve::IsShm(job.outfilename))
+        error = "A shm: input needs a shm: output, there is no PNG to write through";
+    else if(job.repetitions < 1)
+        error = "The number of repetitions must be at least 1";
+    else
+        return true;
+    return false;
+}
 
-        sycl::accessor a(a_buf, h, sycl::read_only);
+// Run job on the device of s, from reading its input to writing its output.
+// False, with error set, if it could not, or if --verify found a mismatch.
+bool RunJob(Session &s, const Job &job, std::string &error) {
+    std::cout << "Command: " << job.command << ", input file: " << job.infilename << ", output file: " << job.outfilename << std::endl;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    bool composite = job.command == "composite";
 
-        h.single_task<class ProducerKernel2<2>>(
-            [=]() [[intel::kernel_args_restrict]] {
+    try {
+        // Input, a PNG to unpack or a shared memory image that is packed already
+        std::optional<img::PNG> png;
+        img::PNG_PIXEL_RGBA_16_ROWS indata;
+        serve::SharedImage shm_in;
+        size_t width, height;
+        if(serve::IsShm(job.infilename)) {
+            if(!shm_in.Open(job.infilename, error))
+                return false;
+            width = shm_in.width();
+            height = shm_in.height();
+        } else {
+            perf::ScopedZone decode("PNG decode");
+            png.emplace(std::string("../in/" + job.infilename));
+            decode.End();
+            PERF_ZONE("asRGBA16");
+            indata = png->asRGBA16();
+            width = indata[0].size();
+            height = indata.size();
+        }
+        s.pixels += width * height;
+        perf::SetItems(s.pixels, "px");
+
+        // Images without an alpha channel load with alpha 0, composite them as opaque
+        bool base_opaque = png && png->channels() != 4;
+        if(composite && !LoadOverlay(s, job.infilename2, job.broadcast, width, height, error))
+            return false;
+
+        // Start computation time
+        auto start_time_compute = std::chrono::high_resolution_clock::now();
+        Fit(s, width, height);
+
+        // Pack the input into each lane's band of rows, a shared memory
+        // image is packed already
+        perf::ScopedZone flatten("flatten");
+        if(png) {
+            FlattenLanes(s, indata, composite && base_opaque);
+        } else {
+            for (size_t lane = 0; lane < NUM_LANES; lane++) {
+                sycl::host_accessor band(s.producer_buffers[lane], sycl::write_only, sycl::no_init);
+                memcpy(band.get_pointer(), shm_in.data() + LaneRowBegin(lane, height) * width,
+                       s.in_lanes[lane].size() * sizeof(uint64_t));
+            }
+        }
+        flatten.End();
+
+        for (long repetition = 0; repetition < job.repetitions; repetition++) {
+            if(composite) {
+                perf::ScopedZone kernels("composite kernels", 3 * width * height * sizeof(uint64_t));
+                Composite(s.q, s.producer_buffers, *s.overlay_buffer, s.consumer_buffers,
+                          width, height, s.overlay.cols(), s.overlay.rows());
+                s.q.wait();
+            } else {
+                // Run producer/consumer kernels
+                perf::ScopedZone kernels("flip kernels", 2 * width * height * sizeof(uint64_t));
+                Flip(s.q, s.producer_buffers, s.consumer_buffers, width, height);
+                s.q.wait();
+            }
+        }
 
-            size_t iters_per_row = (width / 16) + ((width % 16 == 0) ? 0 : 1);
+        {
+            PERF_ZONE("buffer writeback");
+            WritebackLanes(s);
+        }
 
-            [[intel::loop_coalesce(3)]]
-            for (size_t i = 0; i < height; i++) { // for each row
-                for (size_t j = 0; j < iters_per_row; j++) {
-                    #pragma unroll
-                    for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
-                        size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
-                        ProducerToConsumerPipe2::write(a[(i * width) + (width - 1) - idx]);
-                    }
+        // End computation time
+        auto end_time_compute = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> process_time_compute(end_time_compute -
+                                                                               start_time_compute);
+        std::cout << "Computation was " << process_time_compute.count() << " milliseconds\n";
+
+        bool verified = !verify_output || VerifyLanes(job.command, s.in_lanes, s.out_lanes, s.overlay, width, height);
+
+        if(serve::IsShm(job.outfilename)) {
+            // Packed as it is in the lanes, only composite's alpha is undone
+            PERF_ZONE("shm output");
+            serve::SharedImage shm_out;
+            if(!shm_out.Create(job.outfilename, width, height, error))
+                return false;
+            for (size_t lane = 0; lane < NUM_LANES; lane++) {
+                const Matrix<uint64_t> &band = s.out_lanes[lane];
+                uint64_t *dst = shm_out.data() + LaneRowBegin(lane, height) * width;
+                if(!composite || base_opaque) {
+                    memcpy(dst, band.data(), band.size() * sizeof(uint64_t));
+                    continue;
                 }
+                for (size_t k = 0; k < band.size(); k++)
+                    dst[k] = Unpremultiply(band.data()[k]);
+            }
+        } else if(!job.outfilename.empty()) {
+            // Create 2d output vector
+            img::PNG_PIXEL_RGBA_16_ROWS outdata;
+            {
+                PERF_ZONE("output rows");
+                outdata = create_blank_2d_vector(indata);
             }
-        });
-    });
-
-    return e;
-}
-
-sycl::event Consumer1(sycl::queue &q, sycl::buffer<uint64_t, 1> &b_buf, size_t width, size_t height) {
-
-    auto e = q.submit([&](sycl::handler &h) {
-
-        sycl::accessor b(b_buf, h, sycl::write_only, sycl::no_init);
 
-        h.single_task<class ConsumerKernel1<3>>(
-            [=]() [[intel::kernel_args_restrict]] {
+            // Unflatten output data of each lane
+            perf::ScopedZone unflatten("unflatten");
+            UnflattenLanes(s, outdata, composite && !base_opaque);
+            unflatten.End();
 
-            size_t iters_per_row = (width / 16) + ((width % 16 == 0) ? 0 : 1);
+            // PNG Output
+            {
+                PERF_ZONE("fromRGBA16");
+                png->fromRGBA16(outdata);
+            }
+            {
+                PERF_ZONE("saveToFile");
+                png->saveToFile(std::string("../out/" + job.outfilename));
+            }
+        }
 
-            [[intel::loop_coalesce(3)]]
-                for (size_t i = 0; i < height; i++) { // for each row
-                    for (size_t j = 0; j < iters_per_row; j++) {
-                        #pragma unroll
-                        for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
-                            size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
-                            b[(i * width) + idx] = ProducerToConsumerPipe1::read();
-                        }
-                    }
-                }
-        });
-    });
+        if(!verified) {
+            error = "Output does not match the host reference";
+            return false;
+        }
+    } catch (std::exception const & e) {
+        error = e.what();
+        return false;
+    }
 
-    return e;
+    // End overall time
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> process_time(end_time - start_time);
+        std::cout << "Computation and I/O was " << process_time.count() << " milliseconds\n";
+    return true;
 }
 
-sycl::event Consumer2(sycl::queue &q, sycl::buffer<uint64_t, 1> &b_buf, size_t width, size_t height) {
-
-    auto e = q.submit([&](sycl::handler &h) {
-
-        sycl::accessor b(b_buf, h, sycl::write_only, sycl::no_init);
-
-        h.single_task<class ConsumerKernel2<4>>(
-            [=]() [[intel::kernel_args_restrict]] {
-
-            size_t iters_per_row = (width / 16) + ((width % 16 == 0) ? 0 : 1);
+// The tables of -p, --mem and --counters and the --trace file, of what was
+// recorded since the last call
+bool Report(const std::string &tracefilename) {
+    if(perf_report) {
+        perf::PrintReport();
+        perf::PrintDeviceReport();
+        perf::PrintMemoryReport();
+        perf::PrintCounterReport();
+    }
+    if(!tracefilename.empty()) {
+        if(!perf::WriteTrace(tracefilename)) {
+            std::cerr << "Failed to write '" << tracefilename << "'" << std::endl;
+            return false;
+        }
+        std::cout << "Trace written to '" << tracefilename << "'\n";
+    }
+    perf::ClearTrace();
+    return true;
+}
 
-            [[intel::loop_coalesce(3)]]
-                for (size_t i = 0; i < height; i++) { // for each row
-                    for (size_t j = 0; j < iters_per_row; j++) {
-                        #pragma unroll
-                        for (size_t x = 0; x < ELEMENTS_PER_DDR_ACCESS; x++) {
-                            size_t idx = j * ELEMENTS_PER_DDR_ACCESS + x;
-                            b[(i * width) + idx] = ProducerToConsumerPipe2::read();
-                        }
-                    }
-                }
-        });
-    });
+// --serve: run the jobs of every client that connects to socket_path, one at
+// a time, on the queue and buffers of s, until one sends "stop". warmup, if
+// set, is flipped once first, so the first client does not pay for loading
+// the kernels and the buffers of its shape. The reports and the trace are of
+// the start up, then of each job in turn, so a daemon that runs for days
+// does not hold on to every zone it ever timed.
+bool Serve(Session &s, const std::string &socket_path, const std::string &warmup,
+           const std::string &tracefilename) {
+    std::string error;
+    if(!warmup.empty()) {
+        Job job;
+        job.command = "flip";
+        job.infilename = warmup;
+        if(!RunJob(s, job, error)) {
+            std::cerr << "Warm up failed: " << error << std::endl;
+            return false;
+        }
+    }
+    if(!Report(tracefilename))
+        return false;
 
-    return e;
+    int listener = serve::Listen(socket_path, error);
+    if(listener < 0) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    std::cout << "Serving jobs on '" << socket_path << "'" << std::endl;
+
+    bool stop = false;
+    while(!stop) {
+        int client = accept(listener, nullptr, nullptr);
+        if(client < 0) {
+            if(errno == EINTR)
+                continue;
+            std::cerr << "accept: " << strerror(errno) << std::endl;
+            break;
+        }
+        // A client that connects and sends nothing must not hold up the rest
+        struct timeval timeout = {serve::kRequestTimeoutSeconds, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::string> args;
+        std::string reply;
+        Job job;
+        bool ran = false;
+        if(!serve::ReceiveRequest(client, args)) {
+            reply = "error Malformed request";
+        } else if(args.size() == 1 && args[0] == "stop") {
+            stop = true;
+            reply = "ok 0";
+        } else {
+            // Repetitions are optional here, the last argument if it is a number
+            if(args.back().find_first_not_of("0123456789") == std::string::npos) {
+                job.repetitions = strtol(args.back().c_str(), nullptr, 10);
+                args.pop_back();
+            }
+            error.clear();
+            for (auto &arg : args) {
+                if(!ParseJobArg(arg, job))
+                    error = "Unknown option '" + arg + "'";
+            }
+            // A client only reaches ../in and ../out, whoever runs the daemon
+            for (const std::string *name : {&job.infilename, &job.infilename2, &job.outfilename}) {
+                if(error.empty() && !serve::IsShm(*name) && !serve::IsPlainName(*name))
+                    error = "File name '" + *name + "' must not contain '/' or '..'";
+            }
+            ran = error.empty() && CheckJob(job, error);
+            if(ran && RunJob(s, job, error)) {
+                std::chrono::duration<double, std::milli> job_time(std::chrono::high_resolution_clock::now() - start_time);
+                reply = "ok " + std::to_string(job_time.count());
+            } else {
+                std::cerr << error << std::endl;
+                reply = "error " + error;
+            }
+        }
+        serve::SendAll(client, reply + "\n");
+        close(client);
+        if(ran && !Report(tracefilename))
+            break;
+    }
+    close(listener);
+    unlink(socket_path.c_str());
+    return true;
 }
 
 int main(int argc, char * argv[]) {
-    std::vector<img::PNG_PIXEL_RGBA<uint16_t>> outdata_flat;
-    std::vector<img::PNG_PIXEL_RGBA<uint16_t>> indata_flat;
-    std::vector<uint64_t> outdata_flat1, outdata_flat2;
-    std::vector<uint64_t> indata_flat1, indata_flat2;
-    char out_file_str_buffer[kMaxStringLen] = {0};
-    char in_file_str_buffer[kMaxStringLen] = {0};
-    sycl::event producer_event1, producer_event2;
-    sycl::event consumer_event1, consumer_event2;
-    img::PNG_PIXEL_RGBA_16_ROWS outdata;
-    img::PNG_PIXEL_RGBA_16_ROWS indata;
-    std::string outfilename = "";
-    std::string infilename = "";
-    std::string command = "";
+    Job job;
+    char trace_str_buffer[kMaxStringLen] = {0};
+    char peak_str_buffer[kMaxStringLen] = {0};
+    std::string socket_path = serve::kDefaultSocket;
+    char warmup_str_buffer[kMaxStringLen] = {0};
+    bool serve_jobs = false;
 
     // Create device selector for the device of your interest.
     #if FPGA_EMULATOR
@@ -177,35 +350,55 @@ int main(int argc, char * argv[]) {
     auto selector = sycl::ext::intel::fpga_selector_v;
     #else
     // The default device selector will select the most performant device.
-    auto selector = default_selector_v;
+    auto selector = sycl::default_selector_v;
     #endif
 
+    // A daemon takes its jobs from the socket, and no repetitions
+    for(int i = 1; i < argc; i++) {
+        std::string sarg(argv[i]);
+        if(sarg == "--serve") {
+            serve_jobs = true;
+        } else if(sarg.compare(0, 8, "--serve=") == 0) {
+            // Whole, a socket path may well be longer than kMaxStringLen
+            serve_jobs = true;
+            socket_path = sarg.substr(8);
+        }
+    }
+
     // Argument processing
-    if(argc != 5) {
+    if(argc < 5 && !serve_jobs) {
         std::cerr << "Incorrect number of arguments. Correct usage: "
               << argv[0]
-              << " [command] -i=<input file> -o=<output file> <# times to perform command>"
+              << " [command] -i=<input file> -o=<output file> [options] <# times to perform command>"
+              << " or " << argv[0] << " --serve[=<socket>] [options]"
               << std::endl;
         return 1;
     }
 
-    for(int i = 1; i < argc-2; i++) {
-        if(argv[i][0] == '-') {
-            std::string sarg(argv[i]);
-            if(std::string(argv[i]) == "-h") {
-                help = true;
-            }
-            if(std::string(argv[i]) == "--help") {
-                help = true;
-            }
-            FindGetArgString(sarg, "-i=", in_file_str_buffer, kMaxStringLen);
-            FindGetArgString(sarg, "-in=", in_file_str_buffer, kMaxStringLen);
-            FindGetArgString(sarg, "--input-file=", in_file_str_buffer, kMaxStringLen);
-            FindGetArgString(sarg, "-o=", out_file_str_buffer, kMaxStringLen);
-            FindGetArgString(sarg, "-out=", out_file_str_buffer, kMaxStringLen);
-            FindGetArgString(sarg, "--output-file=", out_file_str_buffer, kMaxStringLen);
-        } else {
-            command = std::string(argv[i]);
+    for(int i = 1; i < (serve_jobs ? argc : argc-1); i++) {
+        std::string sarg(argv[i]);
+        if(sarg == "-h" || sarg == "--help") {
+            help = true;
+        }
+        FindGetArgString(sarg, "--trace=", trace_str_buffer, kMaxStringLen);
+        FindGetArgString(sarg, "--peak-gbps=", peak_str_buffer, kMaxStringLen);
+        FindGetArgString(sarg, "--warmup=", warmup_str_buffer, kMaxStringLen);
+        if(sarg == "-p" || sarg == "--perf") {
+            perf_report = true;
+        }
+        if(sarg == "--mem") {
+            perf_report = true;
+            mem_report = true;
+        }
+        if(sarg == "--counters") {
+            perf_report = true;
+            counter_report = true;
+        }
+        if(sarg == "--verify") {
+            verify_output = true;
+        }
+        if(!serve_jobs) {
+            ParseJobArg(sarg, job);
         }
     }
 
@@ -215,141 +408,81 @@ int main(int argc, char * argv[]) {
     }
 
     // Save parsed arguments
-    num_repetitions = atoi(argv[4]);
-    infilename = std::string(in_file_str_buffer);
-    outfilename = std::string(out_file_str_buffer);
-
-    // Start overall time
-    std::cout << "Command: " << command << ", input file: " << infilename << ", output file: " << outfilename << std::endl;
-
-    auto start_time = std::chrono::high_resolution_clock::now();
-
-    // PNG Input
-    img::PNG png(std::string("../in/" + infilename));
-    indata = png.asRGBA16();
-    size_t width = indata[0].size();
-    size_t height = indata.size();
-
-    // Create 2d output vector
-    outdata = create_blank_2d_vector(indata);
-
-    // Flatten 2d vectors
-    for (size_t i = 0; i < height/2; i++) {
-        for (size_t j = 0; j < width; j++) {
-            indata_flat1.push_back(static_cast<uint64_t>(indata[i][j]));
+    std::string error;
+    if(!serve_jobs) {
+        job.repetitions = atol(argv[argc-1]);
+        if(!CheckJob(job, error)) {
+            std::cerr << error << std::endl;
+            if(job.command != "flip" && job.command != "composite")
+                Help();
+            return 1;
         }
     }
-    for (size_t i = height/2; i < height; i++) {
-        for (size_t j = 0; j < width; j++) {
-            indata_flat2.push_back(static_cast<uint64_t>(indata[i][j]));
-        }
-    }
-    outdata_flat1.resize(indata_flat1.size());
-    outdata_flat2.resize(indata_flat2.size());
 
-    for (size_t i = 0; i < height; i++) {
-        for (size_t j = 0; j < width; j++) {
-            indata_flat.push_back(indata[i][j]);
+    std::string tracefilename(trace_str_buffer);
+    if(perf_report) {
+        // Peak of the board's DDR, or of the host memory the emulator runs in
+        if(peak_str_buffer[0] != 0)
+            perf::SetPeak(atof(peak_str_buffer), "--peak-gbps");
+        else {
+            #if FPGA_HARDWARE
+            perf::SetPeak(kNumMemChannels * kMemChannelGBps,
+                          "S10 PAC, " + std::to_string(kNumMemChannels) + " DDR4-2400 channels");
+            #else
+            perf::SetPeak(perf::MeasureStreamCopy(), "host STREAM copy");
+            #endif
         }
+        // The lane kernels are traced too, for their bandwidth
+        perf::EnableTrace();
     }
-    outdata_flat.resize(indata_flat.size());
-
-    size_t height1 = indata_flat1.size()/width;
-    size_t height2 = indata_flat2.size()/width;
-
-    // Start computation time
-    auto start_time_compute = std::chrono::high_resolution_clock::now();
-
+    if(!tracefilename.empty())
+        perf::EnableTrace();
+    if(mem_report)
+        perf::EnableMemory();
+    // Before the queue, the runtime's threads inherit the counters
+    if(counter_report)
+        perf::EnableCounters();
+
+    bool passed = true;
     try {
-        sycl::queue q(selector, exception_handler);
+        perf::ScopedZone creation("queue creation");
+        sycl::queue q(selector, exception_handler, perf::QueueProperties());
+        creation.End();
         std::cout << "Running on device: " << q.get_device().get_info < sycl::info::device::name > () << "\n";
 
-        if(command.compare("flip") == 0) {
-
-            // Create flat vector producer/consumer buffers
-            sycl::buffer producer_buffer1(indata_flat1, {sycl::property::buffer::mem_channel{1}});
-            sycl::buffer producer_buffer2(indata_flat2, {sycl::property::buffer::mem_channel{2}});
-            sycl::buffer consumer_buffer1(outdata_flat1, {sycl::property::buffer::mem_channel{3}});
-            sycl::buffer consumer_buffer2(outdata_flat2, {sycl::property::buffer::mem_channel{4}});
-
-            for (size_t repetition = 0; repetition < num_repetitions; repetition++) {
-                // Run producer/consumer kernels
-                producer_event1 = Producer1(q, producer_buffer1, width, height1);
-                consumer_event1 = Consumer1(q, consumer_buffer1, width, height1);
-                producer_event2 = Producer2(q, producer_buffer2, width, height2);
-                consumer_event2 = Consumer2(q, consumer_buffer2, width, height2);
-                q.wait();
-            }
+        #if FPGA_EMULATOR
+        // Report the memory port of every kernel so builds can be compared
+        for (size_t lane = 0; lane < NUM_LANES; lane++) {
+            std::cout << "Lane " << lane << " producer read port: " << lsu_policy::LSU_POLICY::kLoadName
+                      << " LSU (mem_channel " << ProducerMemChannel(lane) << ")\n";
+            std::cout << "Lane " << lane << " consumer write port: " << lsu_policy::LSU_POLICY::kStoreName
+                      << " LSU (mem_channel " << ConsumerMemChannel(lane) << ")\n";
         }
+        if(serve_jobs || job.command == "composite") {
+            std::cout << "Overlay read port: " << lsu_policy::LSU_POLICY::kLoadName
+                      << " LSU (mem_channel " << OverlayMemChannel() << ")\n";
+        }
+        #endif
 
+        Session session(q);
+        if(serve_jobs) {
+            passed = Serve(session, socket_path, warmup_str_buffer, tracefilename);
+        } else if(!RunJob(session, job, error)) {
+            passed = false;
+        }
     } catch (std::exception const & e) {
         std::cout << "An exception is caught for vector add.\n";
         std::terminate();
     }
 
-    // End computation time
-    auto end_time_compute = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> process_time_compute(end_time_compute -
-                                                                           start_time_compute);
-    std::cout << "Computation was " << process_time_compute.count() << " milliseconds\n";
-
-    // Unflatten top half of output data
-    for (size_t i = 0; i < height/2; i++) {
-        for (size_t j = 0; j < width; j++) {
-            uint64_t val = outdata_flat1[(i*width)+j];
-
-            // Convert uint64_t to PNG_PIXEL_RGBA
-            img::PNG_PIXEL_RGBA<uint16_t> tmp;
-            uint16_t r = (uint16_t)(val >> 48);
-            uint16_t g = (uint16_t)(val >> 32) & 0xFFFF;
-            uint16_t b = (uint16_t)(val >> 16) & 0xFFFF;
-            uint16_t a = (uint16_t)(val & 0xFFFF);
-            tmp.data[0] = r;
-            tmp.data[1] = g;
-            tmp.data[2] = b;
-            tmp.data[3] = a;
-            tmp.rgba.r = r;
-            tmp.rgba.g = g;
-            tmp.rgba.b = b;
-            tmp.rgba.a = a;
-
-            outdata[i][j] = tmp;
-        }
-    }
+    if(!serve_jobs && !Report(tracefilename))
+        return 1;
 
-    // Unflatten bottom half of output data
-    for (size_t i = height/2; i < height; i++) {
-        for (size_t j = 0; j < width; j++) {
-            uint64_t val = outdata_flat2[((i-(height/2))*width)+j];
-
-            // Convert uint64_t to PNG_PIXEL_RGBA
-            img::PNG_PIXEL_RGBA<uint16_t> tmp;
-            uint16_t r = (uint16_t)(val >> 48);
-            uint16_t g = (uint16_t)(val >> 32) & 0xFFFF;
-            uint16_t b = (uint16_t)(val >> 16) & 0xFFFF;
-            uint16_t a = (uint16_t)(val & 0xFFFF);
-            tmp.data[0] = r;
-            tmp.data[1] = g;
-            tmp.data[2] = b;
-            tmp.data[3] = a;
-            tmp.rgba.r = r;
-            tmp.rgba.g = g;
-            tmp.rgba.b = b;
-            tmp.rgba.a = a;
-
-            outdata[i][j] = tmp;
-        }
+    if(!passed) {
+        if(!error.empty())
+            std::cerr << error << std::endl;
+        return 1;
     }
-
-    // PNG Output
-    png.fromRGBA16(outdata);
-    png.saveToFile(std::string("../out/output.png"));
-
-    // End overall time
-    auto end_time = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> process_time(end_time - start_time);
-        std::cout << "Computation and I/O was " << process_time.count() << " milliseconds\n";
-
     std::cout << "Vector add successfully completed on device.\n";
     return 0;
 }
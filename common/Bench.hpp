@@ -0,0 +1,709 @@
+// Bench.hpp
+//
+// Benchmark harness of both projects' bench. Every stage of a run is timed
+// on its own (decode, flatten, h2d, kernel, d2h, unflatten, encode) over
+// every combination of inputs, commands, engines and repetition counts,
+// after a number of warmup runs. Each stage is summarized as median, p95,
+// stddev, mean and min over the samples. Results go to stdout, and
+// optionally to JSON and CSV files that can be diffed across commits.
+//
+// With --save-baseline the JSON is kept as the baseline of a machine profile
+// in bench/baselines/. --compare re-runs every case of that baseline, with
+// its settings, and tests each stage's samples against the baseline's with
+// a one-sided Mann-Whitney U test. A gated stage that is slower by more
+// than --threshold percent, at a p below --alpha, is a regression, and bench
+// exits with 2. A missing baseline is an error too, exit 1, unless
+// --allow-missing-baseline skips the comparison instead.
+//
+// A bench supplies the engines, the commands they run and any parameters
+// of those commands as a Suite, and hands it to Main().
+//
+
+#ifndef BENCH_HPP__
+#define BENCH_HPP__
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+
+#include "Json.hpp"
+
+namespace bench {
+
+// Stages of one run, in the order they happen
+const std::vector<std::string> kStages = {"decode", "flatten", "h2d", "kernel", "d2h", "unflatten", "encode", "total"};
+
+// Stages --compare fails on unless --gate says otherwise. PNG decoding and
+// encoding go through the disk and move by more than any sensible
+// threshold from one run to the next, and so does everything that adds
+// them up.
+const std::vector<std::string> kGatedStages = {"flatten", "h2d", "kernel", "d2h"};
+
+// What this bench was built for, baselines are kept per build
+#if FPGA_EMULATOR
+constexpr const char *kBuild = "fpga_emu";
+#elif FPGA_SIMULATOR
+constexpr const char *kBuild = "fpga_sim";
+#elif FPGA_HARDWARE
+constexpr const char *kBuild = "fpga";
+#else
+constexpr const char *kBuild = "cpu";
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+static inline double Ms(Clock::time_point begin, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Suites
+////////////////////////////////////////////////////////////////////////////////
+
+// A numeric parameter of the suite's commands, --<name>=<n>, recorded in
+// the JSON so a baseline is re-run with it
+struct Param {
+    std::string name;
+    long value;
+    std::string help;
+    long min = LONG_MIN;	// Smallest value the bench accepts
+};
+
+// Settings every case of a run shares
+struct Config {
+    std::string input2;		// Second image of two image commands, each input if empty
+    size_t warmup = 2;
+    size_t samples = 10;
+    std::vector<Param> params;	// The suite's, with this run's values
+
+    long param(const std::string &name) const {
+        for (auto &p : params)
+            if(p.name == name)
+                return p.value;
+        return 0;
+    }
+};
+
+class Engine {
+public:
+    virtual ~Engine(void) {}
+    virtual std::string name(void) const = 0;
+    virtual std::string description(void) const = 0;
+    virtual bool supports(const std::string &command) const { return true; }
+    // One full run of command on ../in/input, input2 being the second image
+    // of commands that take two: the time of every stage in ms, per kStages,
+    // -1 for a stage the engine does not have. width and height are set to
+    // the input's.
+    virtual std::vector<double> Sample(const std::string &command, const std::string &input, const std::string &input2,
+                                       size_t reps, size_t &width, size_t &height) = 0;
+};
+
+struct Suite {
+    std::vector<std::string> commands;		// The first is the default
+    std::vector<std::string> two_input_commands;	// Those that read input2 too
+    std::vector<std::string> engines;
+    std::vector<std::string> default_engines;
+    std::vector<Param> params;
+    // The engine name runs with config, nullptr if it is not one
+    std::function<Engine *(const std::string &name, const Config &config)> make_engine;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics
+////////////////////////////////////////////////////////////////////////////////
+
+struct Summary {
+    double median = 0;
+    double p95 = 0;
+    double stddev = 0;
+    double mean = 0;
+    double min = 0;
+};
+
+static inline Summary Summarize(std::vector<double> samples) {
+    Summary s;
+    if(samples.empty())
+        return s;
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    s.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    s.p95 = samples[(size_t)std::ceil(0.95 * n) - 1];	// Nearest rank
+    s.min = samples[0];
+    for (double v : samples)
+        s.mean += v;
+    s.mean /= n;
+    for (double v : samples)
+        s.stddev += (v - s.mean) * (v - s.mean);
+    s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0;
+    return s;
+}
+
+// One-sided Mann-Whitney U test that samples of b tend to be larger than
+// samples of a. Ties get their average rank, and the normal approximation
+// is corrected for ties and continuity, which is close enough from about 8
+// samples a side. Returns the p value, 1 when there is nothing to test.
+static inline double MannWhitneyGreater(const std::vector<double> &a, const std::vector<double> &b) {
+    size_t na = a.size(), nb = b.size(), n = na + nb;
+    if(na == 0 || nb == 0)
+        return 1;
+    std::vector<std::pair<double, bool>> all;	// Value, from b
+    for (double v : a)
+        all.emplace_back(v, false);
+    for (double v : b)
+        all.emplace_back(v, true);
+    std::sort(all.begin(), all.end());
+
+    double rank_sum_b = 0, ties = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while(j < n && all[j].first == all[i].first)
+            j++;
+        double rank = (i + 1 + j) / 2.0;	// Average of ranks i+1..j
+        for (size_t k = i; k < j; k++)
+            if(all[k].second)
+                rank_sum_b += rank;
+        double t = j - i;
+        ties += t * t * t - t;
+        i = j;
+    }
+    double u = rank_sum_b - nb * (nb + 1) / 2.0;
+    double mean = na * nb / 2.0;
+    double var = na * nb / 12.0 * ((n + 1) - ties / (n * (n - 1.0)));
+    if(var <= 0)
+        return 1;
+    double z = (u - mean - 0.5) / std::sqrt(var);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+////////////////////////////////////////////////////////////////////////////////
+
+// One case of a run, or of a baseline
+struct Result {
+    std::string input;
+    std::string command;
+    std::string engine;
+    std::string device;
+    size_t reps = 1;
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<std::vector<double>> samples;	// [stage][sample] in ms, per kStages
+};
+
+static inline std::string JsonString(const std::string &s) {
+    std::string out = "\"";
+    for (char ch : s) {
+        if(ch == '"' || ch == '\\')
+            out += '\\';
+        out += ch;
+    }
+    return out + "\"";
+}
+
+static inline void PrintTitle(const Result &r) {
+    std::cout << "\n" << r.input << " (" << r.width << "x" << r.height << "), " << r.command
+              << ", " << r.engine << ", " << r.reps << " reps\n";
+}
+
+static inline void PrintTable(const Result &r) {
+    PrintTitle(r);
+    std::cout << std::left << std::setw(12) << "  stage" << std::right
+              << std::setw(12) << "median ms" << std::setw(12) << "p95 ms"
+              << std::setw(12) << "stddev ms" << std::setw(12) << "min ms" << "\n";
+    for (size_t s = 0; s < kStages.size(); s++) {
+        if(r.samples[s].empty())
+            continue;
+        Summary sum = Summarize(r.samples[s]);
+        std::cout << std::left << std::setw(12) << ("  " + kStages[s]) << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << sum.median << std::setw(12) << sum.p95
+                  << std::setw(12) << sum.stddev << std::setw(12) << sum.min << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+}
+
+static inline bool WriteJson(const std::string &path, const std::string &label, const Config &config,
+                             const std::vector<Result> &results) {
+    std::ofstream f(path);
+    if(!f)
+        return false;
+    char hostname[256] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+
+    f << std::setprecision(6);
+    f << "{\n  \"label\": " << JsonString(label) << ",\n  \"host\": " << JsonString(hostname)
+      << ",\n  \"time\": " << (long long)std::time(nullptr) << ",\n  \"build\": " << JsonString(kBuild)
+      << ",\n  \"warmup\": " << config.warmup << ",\n  \"samples\": " << config.samples
+      << ",\n  \"input2\": " << JsonString(config.input2);
+    for (auto &p : config.params)
+        f << ",\n  " << JsonString(p.name) << ": " << p.value;
+    f << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        f << (i ? "," : "") << "\n    {\"input\": " << JsonString(r.input)
+          << ", \"command\": " << JsonString(r.command)
+          << ", \"engine\": " << JsonString(r.engine)
+          << ", \"device\": " << JsonString(r.device)
+          << ", \"reps\": " << r.reps << ", \"width\": " << r.width << ", \"height\": " << r.height
+          << ",\n     \"stages\": {";
+        bool first = true;
+        for (size_t s = 0; s < kStages.size(); s++) {
+            if(r.samples[s].empty())
+                continue;
+            Summary sum = Summarize(r.samples[s]);
+            f << (first ? "" : ",") << "\n       " << JsonString(kStages[s]) << ": {\"median\": " << sum.median
+              << ", \"p95\": " << sum.p95 << ", \"stddev\": " << sum.stddev << ", \"mean\": " << sum.mean
+              << ", \"min\": " << sum.min << ", \"samples\": [";
+            for (size_t k = 0; k < r.samples[s].size(); k++)
+                f << (k ? ", " : "") << r.samples[s][k];
+            f << "]}";
+            first = false;
+        }
+        f << "}}";
+    }
+    f << "\n  ]\n}\n";
+    return (bool)f;
+}
+
+static inline bool WriteCsv(const std::string &path, const std::vector<Result> &results) {
+    std::ofstream f(path);
+    if(!f)
+        return false;
+    f << "input,command,engine,reps,width,height,stage,median_ms,p95_ms,stddev_ms,mean_ms,min_ms\n";
+    for (const Result &r : results) {
+        for (size_t s = 0; s < kStages.size(); s++) {
+            if(r.samples[s].empty())
+                continue;
+            Summary sum = Summarize(r.samples[s]);
+            f << r.input << "," << r.command << "," << r.engine << "," << r.reps << ","
+              << r.width << "," << r.height << "," << kStages[s] << "," << sum.median << "," << sum.p95 << ","
+              << sum.stddev << "," << sum.mean << "," << sum.min << "\n";
+        }
+    }
+    return (bool)f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Baselines
+// A baseline is the --json output of an earlier run. Comparing re-runs its
+// cases in the same order with its settings, so results and baseline cases
+// line up one to one.
+////////////////////////////////////////////////////////////////////////////////
+
+struct Baseline {
+    std::string label;
+    std::string host;
+    std::string build;
+    Config config;
+    std::vector<Result> cases;
+};
+
+// Where --save-baseline and --compare keep a profile's baseline, from build/
+static inline std::string BaselinePath(const std::string &profile) {
+    return "../bench/baselines/" + profile + "." + kBuild + ".json";
+}
+
+// The parameters of defaults are read back by name, a baseline without one
+// keeps its default
+static inline Baseline LoadBaseline(const std::string &path, const Config &defaults) {
+    std::ifstream f(path);
+    if(!f)
+        throw std::runtime_error("Failed to open baseline '" + path + "'");
+    std::stringstream text;
+    text << f.rdbuf();
+    json::Value doc = json::Parse(text.str());
+
+    Baseline b;
+    b.label = doc["label"].str();
+    b.host = doc["host"].str();
+    b.build = doc["build"].str();
+    b.config = defaults;
+    b.config.input2 = doc["input2"].str();
+    double warmup = doc["warmup"].num(2), samples = doc["samples"].num(10);
+    if(warmup < 0 || samples < 1)
+        throw std::runtime_error("Baseline '" + path + "' has a negative warmup or no samples");
+    b.config.warmup = (size_t)warmup;
+    b.config.samples = (size_t)samples;
+    for (auto &p : b.config.params)
+        p.value = (long)doc[p.name].num(p.value);
+    for (const json::Value &r : doc["results"].array) {
+        Result c;
+        c.input = r["input"].str();
+        c.command = r["command"].str();
+        c.engine = r["engine"].str();
+        c.device = r["device"].str();
+        double reps = r["reps"].num(1);
+        if(reps < 1)
+            throw std::runtime_error("Baseline '" + path + "' has a case of fewer than 1 repetition");
+        c.reps = (size_t)reps;
+        c.samples.resize(kStages.size());
+        for (size_t s = 0; s < kStages.size(); s++)
+            for (const json::Value &v : r["stages"][kStages[s]]["samples"].array)
+                c.samples[s].push_back(v.num());
+        b.cases.push_back(std::move(c));
+    }
+    if(b.cases.empty())
+        throw std::runtime_error("Baseline '" + path + "' has no results");
+    return b;
+}
+
+// Stage by stage comparison of a result with its baseline case, returns the
+// number of regressions in the gated stages. Change is of the median; a
+// stage is only flagged when the test agrees it moved.
+static inline size_t PrintComparison(const Result &r, const Result &base, const std::vector<std::string> &gated,
+                                     double threshold_percent, double alpha) {
+    PrintTitle(r);
+    if(base.device != r.device)
+        std::cout << "  note: baseline ran on '" << base.device << "'\n";
+    std::cout << std::left << std::setw(12) << "  stage" << std::right
+              << std::setw(12) << "base ms" << std::setw(12) << "now ms"
+              << std::setw(10) << "change" << std::setw(10) << "p" << "\n";
+    size_t regressions = 0;
+    for (size_t s = 0; s < kStages.size(); s++) {
+        if(r.samples[s].empty() || base.samples[s].empty())
+            continue;
+        double before = Summarize(base.samples[s]).median;
+        double now = Summarize(r.samples[s]).median;
+        double change = before > 0 ? 100.0 * (now - before) / before : 0;
+        double p_slower = MannWhitneyGreater(base.samples[s], r.samples[s]);
+        double p_faster = MannWhitneyGreater(r.samples[s], base.samples[s]);
+        bool gate = std::find(gated.begin(), gated.end(), kStages[s]) != gated.end();
+        std::string verdict;
+        if(p_slower < alpha && change > threshold_percent) {
+            verdict = gate ? "REGRESSION" : "slower, not gated";
+            regressions += gate;
+        } else if(p_faster < alpha && change < -threshold_percent) {
+            verdict = "faster";
+        }
+        std::ostringstream pct;
+        pct << std::showpos << std::fixed << std::setprecision(1) << change << "%";
+        std::cout << std::left << std::setw(12) << ("  " + kStages[s]) << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << before << std::setw(12) << now << std::setw(10) << pct.str()
+                  << std::setw(10) << std::setprecision(4) << std::min(p_slower, p_faster) << (verdict.empty() ? "" : "  " + verdict) << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+    return regressions;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Arguments
+////////////////////////////////////////////////////////////////////////////////
+
+static inline std::string JoinList(const std::vector<std::string> &items) {
+    std::string list;
+    for (auto &item : items)
+        list += (list.empty() ? "" : ",") + item;
+    return list;
+}
+
+static inline void Help(const Suite &suite) {
+    auto option = [](const std::string &text) { return "  " + text + std::string(text.size() < 41 ? 41 - text.size() : 1, ' ') + ": "; };
+    std::cout << "bench -i=<image>[,<image>...] [options]\n";
+    std::cout << option("-h,--help") << "this help text\n";
+    std::cout << option("-i=<image>[,...]") << "inputs in ../in/\n";
+    if(!suite.two_input_commands.empty())
+        std::cout << option("-i2=<image>") << "second image of " << JoinList(suite.two_input_commands) << " (default: each input)\n";
+    std::cout << option("--commands=<" + JoinList(suite.commands) + ">") << "commands to time (default " << suite.commands[0] << ")\n";
+    std::cout << option("--engines=<" + JoinList(suite.engines) + ">") << "engines to time (default " << JoinList(suite.default_engines) << ")\n";
+    std::cout << option("--reps=<n>[,...]") << "kernel repetitions per run (default 1)\n";
+    std::cout << option("--warmup=<n>") << "untimed runs per case (default 2)\n";
+    std::cout << option("--samples=<n>") << "timed runs per case (default 10)\n";
+    for (auto &p : suite.params)
+        std::cout << option("--" + p.name + "=<n>") << p.help << " (default " << p.value << ")\n";
+    std::cout << option("--json=<file> --csv=<file>") << "also write the results here\n";
+    std::cout << option("--label=<text>") << "recorded in the JSON, e.g. the commit\n";
+    std::cout << option("--profile=<name>") << "machine profile of the baseline (default: host name)\n";
+    std::cout << option("--save-baseline") << "keep this run as the profile's baseline\n";
+    std::cout << option("--compare[=<baseline.json>]") << "re-run the profile's baseline and test for regressions,\n";
+    std::cout << std::string(45, ' ') << "exits with 2 if there are any\n";
+    std::cout << option("--allow-missing-baseline") << "skip --compare if the profile has no baseline,\n";
+    std::cout << std::string(45, ' ') << "instead of failing\n";
+    std::cout << option("--gate=<stage>[,...]") << "stages a regression fails (default " << JoinList(kGatedStages) << ")\n";
+    std::cout << option("--threshold=<percent>") << "slowdown of the median that counts (default 5)\n";
+    std::cout << option("--alpha=<p>") << "significance the test must reach (default 0.01)\n";
+}
+
+// Value after prefix, whole argument
+static inline bool FindGetArgValue(const std::string &arg, const char *prefix, std::string &value) {
+    size_t len = strlen(prefix);
+    if(arg.compare(0, len, prefix) != 0)
+        return false;
+    value = arg.substr(len);
+    return true;
+}
+
+static inline std::vector<std::string> SplitList(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static inline int Main(int argc, char *argv[], const Suite &suite) {
+    std::vector<std::string> inputs, commands = {suite.commands[0]}, engine_names = suite.default_engines;
+    std::vector<size_t> reps_list = {1};
+    std::string json_path, csv_path, label, profile, compare_path;
+    Config config;
+    config.params = suite.params;
+    bool help = argc < 2, save_baseline = false, compare = false, warmup_set = false, samples_set = false;
+    bool allow_missing_baseline = false;
+    double threshold_percent = 5, alpha = 0.01;
+    std::vector<std::string> gated = kGatedStages;
+
+    for (int i = 1; i < argc; i++) {
+        std::string sarg(argv[i]), value;
+        if(sarg == "-h" || sarg == "--help")
+            help = true;
+        if(FindGetArgValue(sarg, "-i=", value))
+            inputs = SplitList(value);
+        if(FindGetArgValue(sarg, "-i2=", value))
+            config.input2 = value;
+        if(FindGetArgValue(sarg, "--commands=", value))
+            commands = SplitList(value);
+        if(FindGetArgValue(sarg, "--engines=", value))
+            engine_names = SplitList(value);
+        if(FindGetArgValue(sarg, "--reps=", value)) {
+            reps_list.clear();
+            for (auto &r : SplitList(value))
+                reps_list.push_back(std::max(1L, atol(r.c_str())));
+        }
+        if(FindGetArgValue(sarg, "--warmup=", value)) {
+            long warmup = atol(value.c_str());
+            if(warmup < 0) {
+                std::cerr << "--warmup must not be negative" << std::endl;
+                return 1;
+            }
+            config.warmup = warmup;
+            warmup_set = true;
+        }
+        if(FindGetArgValue(sarg, "--samples=", value)) {
+            config.samples = std::max(1L, atol(value.c_str()));
+            samples_set = true;
+        }
+        for (auto &p : config.params)
+            if(FindGetArgValue(sarg, ("--" + p.name + "=").c_str(), value))
+                p.value = atol(value.c_str());
+        if(FindGetArgValue(sarg, "--json=", value))
+            json_path = value;
+        if(FindGetArgValue(sarg, "--csv=", value))
+            csv_path = value;
+        if(FindGetArgValue(sarg, "--label=", value))
+            label = value;
+        if(FindGetArgValue(sarg, "--profile=", value))
+            profile = value;
+        if(sarg == "--save-baseline")
+            save_baseline = true;
+        if(sarg == "--compare")
+            compare = true;
+        if(FindGetArgValue(sarg, "--compare=", value)) {
+            compare = true;
+            compare_path = value;
+        }
+        if(sarg == "--allow-missing-baseline")
+            allow_missing_baseline = true;
+        if(FindGetArgValue(sarg, "--gate=", value))
+            gated = SplitList(value);
+        if(FindGetArgValue(sarg, "--threshold=", value))
+            threshold_percent = atof(value.c_str());
+        if(FindGetArgValue(sarg, "--alpha=", value))
+            alpha = atof(value.c_str());
+    }
+
+    if(help) {
+        Help(suite);
+        return 1;
+    }
+    // Saving the run being compared would replace the baseline it is
+    // compared with
+    if(compare && save_baseline) {
+        std::cerr << "--compare and --save-baseline cannot be combined" << std::endl;
+        return 1;
+    }
+    if(profile.empty()) {
+        char hostname[256] = {0};
+        gethostname(hostname, sizeof(hostname) - 1);
+        profile = hostname;
+    }
+    // A gate that finds no baseline has checked nothing, so that fails
+    // unless it was asked for
+    if(compare && compare_path.empty()) {
+        compare_path = BaselinePath(profile);
+        if(!std::filesystem::exists(compare_path)) {
+            if(allow_missing_baseline) {
+                std::cout << "No baseline for profile " << profile << " at '" << compare_path
+                          << "', skipping the comparison. Save one with --save-baseline.\n";
+                return 0;
+            }
+            std::cerr << "No baseline for profile " << profile << " at '" << compare_path
+                      << "'. Save one with --save-baseline, or skip the comparison with"
+                      << " --allow-missing-baseline." << std::endl;
+            return 1;
+        }
+    }
+
+    // The cases to run, in order: every combination of the arguments, or
+    // when comparing, every case of the baseline with its settings
+    std::vector<Result> specs;
+    Baseline baseline;
+    if(compare) {
+        try {
+            baseline = LoadBaseline(compare_path, config);
+        } catch (std::exception const & e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if(!baseline.build.empty() && baseline.build != kBuild)
+            std::cout << "Warning: baseline is of a " << baseline.build << " build, this is " << kBuild << "\n";
+        Config base_config = baseline.config;
+        if(warmup_set)
+            base_config.warmup = config.warmup;
+        if(samples_set)
+            base_config.samples = config.samples;
+        config = base_config;
+        engine_names.clear();
+        for (auto &c : baseline.cases) {
+            specs.push_back(c);
+            if(std::find(engine_names.begin(), engine_names.end(), c.engine) == engine_names.end())
+                engine_names.push_back(c.engine);
+        }
+        std::cout << "Comparing with '" << compare_path << "'"
+                  << (baseline.label.empty() ? "" : " (" + baseline.label + ")") << " from " << baseline.host << "\n";
+    } else {
+        if(inputs.empty()) {
+            std::cerr << "No inputs, -i=<image>[,<image>...]" << std::endl;
+            return 1;
+        }
+        for (auto &command : commands) {
+            if(std::find(suite.commands.begin(), suite.commands.end(), command) == suite.commands.end()) {
+                std::cerr << "Unknown command '" << command << "'" << std::endl;
+                return 1;
+            }
+        }
+        for (auto &input : inputs) {
+            for (auto &command : commands) {
+                for (auto &engine : engine_names) {
+                    for (size_t reps : reps_list) {
+                        Result spec;
+                        spec.input = input;
+                        spec.command = command;
+                        spec.engine = engine;
+                        spec.reps = reps;
+                        specs.push_back(spec);
+                    }
+                }
+            }
+        }
+    }
+
+    // From the command line or the baseline, before an engine casts them
+    for (auto &p : config.params) {
+        if(p.value < p.min) {
+            std::cerr << "--" << p.name << " must be at least " << p.min << std::endl;
+            return 1;
+        }
+    }
+
+    // Engines are built once, so queue creation and device discovery stay
+    // out of every sample
+    std::vector<std::unique_ptr<Engine>> engines;
+    try {
+        for (auto &name : engine_names) {
+            Engine *engine = nullptr;
+            if(std::find(suite.engines.begin(), suite.engines.end(), name) != suite.engines.end())
+                engine = suite.make_engine(name, config);
+            if(engine == nullptr) {
+                std::cerr << "Unknown engine '" << name << "', expected one of " << JoinList(suite.engines) << std::endl;
+                return 1;
+            }
+            engines.emplace_back(engine);
+            std::cout << "Engine " << engine->name() << ": " << engine->description() << "\n";
+        }
+    } catch (std::exception const & e) {
+        std::cerr << "Failed to start an engine: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results;
+    size_t regressions = 0;
+    try {
+        for (size_t i = 0; i < specs.size(); i++) {
+            Engine *engine = engines[std::find(engine_names.begin(), engine_names.end(), specs[i].engine) - engine_names.begin()].get();
+            if(!engine->supports(specs[i].command)) {
+                std::cout << "\nSkipping " << specs[i].command << " on " << engine->name() << "\n";
+                continue;
+            }
+            Result r = specs[i];
+            r.device = engine->description();
+            r.samples.assign(kStages.size(), {});
+            const std::string &second = config.input2.empty() ? r.input : config.input2;
+            for (size_t w = 0; w < config.warmup; w++)
+                engine->Sample(r.command, r.input, second, r.reps, r.width, r.height);
+            for (size_t s = 0; s < config.samples; s++) {
+                std::vector<double> ms = engine->Sample(r.command, r.input, second, r.reps, r.width, r.height);
+                for (size_t k = 0; k < kStages.size(); k++)
+                    if(ms[k] >= 0)
+                        r.samples[k].push_back(ms[k]);
+            }
+            if(compare)
+                regressions += PrintComparison(r, baseline.cases[i], gated, threshold_percent, alpha);
+            else
+                PrintTable(r);
+            results.push_back(std::move(r));
+        }
+    } catch (std::exception const & e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if(save_baseline) {
+        std::string path = BaselinePath(profile);
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        if(!WriteJson(path, label, config, results)) {
+            std::cerr << "Failed to write '" << path << "'" << std::endl;
+            return 1;
+        }
+        std::cout << "\nSaved the baseline of profile " << profile << " to '" << path << "'\n";
+    }
+    if(!json_path.empty()) {
+        if(!WriteJson(json_path, label, config, results)) {
+            std::cerr << "Failed to write '" << json_path << "'" << std::endl;
+            return 1;
+        }
+        std::cout << "\nWrote '" << json_path << "'\n";
+    }
+    if(!csv_path.empty()) {
+        if(!WriteCsv(csv_path, results)) {
+            std::cerr << "Failed to write '" << csv_path << "'" << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote '" << csv_path << "'\n";
+    }
+    if(compare) {
+        std::cout << "\n" << regressions << " regression" << (regressions == 1 ? "" : "s")
+                  << " beyond " << threshold_percent << "% at p < " << alpha << " in " << JoinList(gated) << "\n";
+        if(regressions > 0)
+            return 2;
+    }
+    return 0;
+}
+
+} // namespace bench
+
+#endif // BENCH_HPP__
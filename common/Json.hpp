@@ -0,0 +1,164 @@
+// Json.hpp
+//
+// Just enough of a JSON reader for bench to load the results it wrote
+// earlier. The whole document is parsed into a tree of json::Value; numbers
+// are doubles and objects keep their keys in order.
+//
+
+#ifndef JSON_HPP__
+#define JSON_HPP__
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+
+namespace json {
+
+struct Value {
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<Value> array;
+    std::vector<std::pair<std::string, Value>> object;
+
+    // Member key of an object, a null value if there is none
+    const Value &operator[](const std::string &key) const {
+        static const Value null;
+        for (auto &member : object)
+            if(member.first == key)
+                return member.second;
+        return null;
+    }
+
+    bool has(const std::string &key) const { return (*this)[key].type != Null; }
+    double num(double fallback = 0) const { return type == Number ? number : fallback; }
+    std::string str(const std::string &fallback = "") const { return type == String ? string : fallback; }
+};
+
+class Parser {
+public:
+    explicit Parser(const std::string &text) : m_text(text) {}
+
+    Value Parse(void) {
+        Value v = ParseValue();
+        SkipSpace();
+        if(m_pos != m_text.size())
+            Fail("trailing characters");
+        return v;
+    }
+
+private:
+    [[noreturn]] void Fail(const std::string &what) {
+        throw std::runtime_error("JSON " + what + " at offset " + std::to_string(m_pos));
+    }
+
+    void SkipSpace(void) {
+        while(m_pos < m_text.size() && strchr(" \t\r\n", m_text[m_pos]) != nullptr)
+            m_pos++;
+    }
+
+    bool Take(char ch) {
+        SkipSpace();
+        if(m_pos < m_text.size() && m_text[m_pos] == ch) {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(char ch) {
+        if(!Take(ch))
+            Fail(std::string("expected '") + ch + "'");
+    }
+
+    bool TakeWord(const char *word) {
+        size_t len = strlen(word);
+        if(m_text.compare(m_pos, len, word) != 0)
+            return false;
+        m_pos += len;
+        return true;
+    }
+
+    Value ParseValue(void) {
+        Value v;
+        SkipSpace();
+        if(m_pos >= m_text.size())
+            Fail("unexpected end");
+        char ch = m_text[m_pos];
+        if(ch == '{') {
+            v.type = Value::Object;
+            m_pos++;
+            if(Take('}'))
+                return v;
+            do {
+                SkipSpace();
+                std::string key = ParseString();
+                Expect(':');
+                v.object.emplace_back(key, ParseValue());
+            } while(Take(','));
+            Expect('}');
+        } else if(ch == '[') {
+            v.type = Value::Array;
+            m_pos++;
+            if(Take(']'))
+                return v;
+            do {
+                v.array.push_back(ParseValue());
+            } while(Take(','));
+            Expect(']');
+        } else if(ch == '"') {
+            v.type = Value::String;
+            v.string = ParseString();
+        } else if(TakeWord("true") || TakeWord("false")) {
+            v.type = Value::Bool;
+            v.boolean = ch == 't';
+        } else if(TakeWord("null")) {
+            v.type = Value::Null;
+        } else {
+            const char *begin = m_text.c_str() + m_pos;
+            char *end = nullptr;
+            v.type = Value::Number;
+            v.number = strtod(begin, &end);
+            if(end == begin)
+                Fail("unexpected character");
+            m_pos += end - begin;
+        }
+        return v;
+    }
+
+    // Escapes other than \" and \\ are kept as the character after the
+    // backslash, bench never writes them
+    std::string ParseString(void) {
+        if(m_pos >= m_text.size() || m_text[m_pos] != '"')
+            Fail("expected a string");
+        std::string s;
+        for (m_pos++; m_pos < m_text.size(); m_pos++) {
+            char ch = m_text[m_pos];
+            if(ch == '"') {
+                m_pos++;
+                return s;
+            }
+            if(ch == '\\' && m_pos + 1 < m_text.size())
+                ch = m_text[++m_pos];
+            s += ch;
+        }
+        Fail("unterminated string");
+    }
+
+    const std::string &m_text;
+    size_t m_pos = 0;
+};
+
+inline Value Parse(const std::string &text) {
+    return Parser(text).Parse();
+}
+
+} // namespace json
+
+#endif // JSON_HPP__
@@ -0,0 +1,154 @@
+#ifndef MATRIX_HPP__
+#define MATRIX_HPP__
+
+#include <sycl/sycl.hpp>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+// Matrix
+// A rows x cols matrix in one contiguous row-major allocation. Row r starts
+// at data() + r * cols, so the whole matrix goes to a kernel as one pointer
+// or one buffer, with no per-row allocations and no flatten copy.
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr size_t kMatrixAlign = 64;	// Cache line, and the widest host vector load
+
+// Host memory aligned to Align bytes
+template <typename T, size_t Align = kMatrixAlign>
+struct AlignedAllocator {
+	using value_type = T;
+	template <typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+	AlignedAllocator(void) = default;
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Align> &) {}
+
+	T *allocate(size_t n) {
+		return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+	}
+	void deallocate(T *ptr, size_t) {
+		::operator delete(ptr, std::align_val_t(Align));
+	}
+
+	bool operator==(const AlignedAllocator &) const { return true; }
+	bool operator!=(const AlignedAllocator &) const { return false; }
+};
+
+// USM shared memory of a queue, visible to both the host and its kernels
+template <typename T>
+using SharedAllocator = sycl::usm_allocator<T, sycl::usm::alloc::shared>;
+
+// One row of a matrix
+template <typename T>
+class RowView {
+public:
+	RowView(T *data, size_t size) : m_data(data), m_size(size) {}
+
+	T *data(void) const { return m_data; }
+	size_t size(void) const { return m_size; }
+	T *begin(void) const { return m_data; }
+	T *end(void) const { return m_data + m_size; }
+	T &operator[](size_t col) const { return m_data[col]; }
+
+private:
+	T *m_data;
+	size_t m_size;
+};
+
+// Elements are left uninitialized: every matrix here is filled by a reader
+// or a kernel straight after it is sized.
+template <typename T, typename Allocator = AlignedAllocator<T>>
+class Matrix {
+	static_assert(std::is_trivially_copyable<T>::value, "Matrix elements are copied as bytes");
+
+public:
+	using value_type = T;
+	using allocator_type = Allocator;
+
+	explicit Matrix(const Allocator &alloc = Allocator()) : m_alloc(alloc) {}
+
+	Matrix(size_t rows, size_t cols, const Allocator &alloc = Allocator()) : m_alloc(alloc) {
+		resize(rows, cols);
+	}
+
+	Matrix(Matrix &&other) noexcept : m_alloc(other.m_alloc) {
+		swap(other);
+	}
+
+	Matrix &operator=(Matrix &&other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	Matrix(const Matrix &) = delete;
+	Matrix &operator=(const Matrix &) = delete;
+
+	~Matrix(void) {
+		release();
+	}
+
+	// Reshape to rows x cols, keeping the allocation when it is big enough.
+	// A kept allocation keeps its values, in flat order; a new one starts
+	// uninitialized.
+	void resize(size_t rows, size_t cols) {
+		size_t count = rows * cols;
+		if(count > m_capacity || m_data == nullptr) {
+			release();
+			// Never hand out a null pointer, even for an empty matrix
+			m_capacity = count > 0 ? count : 1;
+			m_data = m_alloc.allocate(m_capacity);
+		}
+		m_rows = rows;
+		m_cols = cols;
+	}
+
+	size_t rows(void) const { return m_rows; }
+	size_t cols(void) const { return m_cols; }
+	size_t size(void) const { return m_rows * m_cols; }
+	bool empty(void) const { return size() == 0; }
+
+	T *data(void) { return m_data; }
+	const T *data(void) const { return m_data; }
+
+	T &operator()(size_t row, size_t col) { return m_data[row * m_cols + col]; }
+	const T &operator()(size_t row, size_t col) const { return m_data[row * m_cols + col]; }
+
+	RowView<T> row(size_t row) { return RowView<T>(m_data + row * m_cols, m_cols); }
+	RowView<const T> row(size_t row) const { return RowView<const T>(m_data + row * m_cols, m_cols); }
+
+	void swap(Matrix &other) noexcept {
+		std::swap(m_alloc, other.m_alloc);
+		std::swap(m_data, other.m_data);
+		std::swap(m_capacity, other.m_capacity);
+		std::swap(m_rows, other.m_rows);
+		std::swap(m_cols, other.m_cols);
+	}
+
+private:
+	void release(void) {
+		if(m_data != nullptr)
+			m_alloc.deallocate(m_data, m_capacity);
+		m_data = nullptr;
+		m_capacity = 0;
+	}
+
+	Allocator m_alloc;
+	T *m_data = nullptr;
+	size_t m_capacity = 0;
+	size_t m_rows = 0;
+	size_t m_cols = 0;
+};
+
+// Buffer over the matrix's own memory. use_host_ptr keeps the runtime from
+// taking a host copy; results land back in the matrix when the buffer is
+// destroyed.
+template <typename T, typename Allocator, typename... Properties>
+sycl::buffer<T, 1> MakeBuffer(Matrix<T, Allocator> &matrix, Properties... properties) {
+	return sycl::buffer<T, 1>(matrix.data(), sycl::range<1>(matrix.size()),
+				  sycl::property_list{sycl::property::buffer::use_host_ptr(), properties...});
+}
+
+#endif // MATRIX_HPP__
@@ -0,0 +1,651 @@
+#ifndef PERF_HPP__
+#define PERF_HPP__
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Scoped timing zones
+// PERF_ZONE("name") times the rest of the enclosing scope; a named
+// perf::ScopedZone can also be ended early with End(). Zones record nothing
+// until perf::Enable() is called (-p/--perf), until then each one costs a
+// relaxed load and a branch. Building with -DPERF_ZONES=0 compiles them out.
+// Names must outlive the report, string literals in practice. A zone that
+// moves a known number of bytes (a kernel) reports GB/s, and the percentage
+// of the peak set with perf::SetPeak(). perf::EnableMemory() (--mem) also
+// has every zone record the heap allocations made while it was open and the
+// resident set at its end, see PerfAlloc.hpp. perf::EnableCounters()
+// (--counters) adds the CPU's hardware counters over each zone.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PERF_ZONES
+#define PERF_ZONES 1
+#endif
+
+namespace perf {
+	using Clock = std::chrono::steady_clock;
+
+	// Heap use, counted by the global operator new and delete of
+	// PerfAlloc.hpp once Enable() is called. Blocks are counted at their
+	// usable size, and only those allocated since, so live can dip below
+	// zero when older blocks are freed.
+	class Heap {
+	public:
+		static Heap &Get(void) {
+			static Heap heap;
+			return heap;
+		}
+
+		bool enabled(void) const { return m_enabled.load(std::memory_order_relaxed); }
+		void Enable(void) { m_enabled.store(true, std::memory_order_relaxed); }
+
+		// Set by PerfAlloc.hpp, heap columns are left out without it
+		bool hooked(void) const { return m_hooked; }
+		void SetHooked(void) { m_hooked = true; }
+
+		void Allocated(size_t size) {
+			m_allocs.fetch_add(1, std::memory_order_relaxed);
+			m_bytes.fetch_add(size, std::memory_order_relaxed);
+			int64_t live = m_live.fetch_add(size, std::memory_order_relaxed) + size;
+			int64_t peak = m_peak.load(std::memory_order_relaxed);
+			while(live > peak && !m_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+				;
+		}
+
+		void Freed(size_t size) {
+			m_live.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		uint64_t allocs(void) const { return m_allocs.load(std::memory_order_relaxed); }
+		uint64_t bytes(void) const { return m_bytes.load(std::memory_order_relaxed); }
+		int64_t live(void) const { return m_live.load(std::memory_order_relaxed); }
+		int64_t peak(void) const { return m_peak.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<bool> m_enabled{false};
+		bool m_hooked = false;
+		std::atomic<uint64_t> m_allocs{0};
+		std::atomic<uint64_t> m_bytes{0};
+		std::atomic<int64_t> m_live{0};
+		std::atomic<int64_t> m_peak{0};
+	};
+
+	// Resident set size now and at its highest, from /proc/self/status. Read
+	// with stdio so that it does not count as a heap allocation itself.
+	static inline void ReadResident(uint64_t &rss_bytes, uint64_t &hwm_bytes) {
+		rss_bytes = hwm_bytes = 0;
+		FILE *f = fopen("/proc/self/status", "r");
+		if(f == nullptr)
+			return;
+		char line[256];
+		unsigned long long kb;
+		while(fgets(line, sizeof(line), f) != nullptr) {
+			if(sscanf(line, "VmRSS: %llu kB", &kb) == 1)
+				rss_bytes = kb * 1024;
+			else if(sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+				hwm_bytes = kb * 1024;
+		}
+		fclose(f);
+	}
+
+	// Hardware counters from perf_event_open, for the whole process: they
+	// are opened with inherit on the thread that calls Enable(), and every
+	// thread it starts afterwards, thread pools and the SYCL runtime's
+	// included, adds to them. Counters the CPU, the VM or
+	// kernel.perf_event_paranoid does not allow are left out; without
+	// cycles there is no table at all, just the reason.
+	enum Counter { kCycles, kInstructions, kLlcMisses, kDtlbMisses, kBranchMisses, kNumCounters };
+
+	struct Counts {
+		uint64_t value[kNumCounters];
+	};
+
+	class Counters {
+	public:
+		static Counters &Get(void) {
+			static Counters counters;
+			return counters;
+		}
+
+		bool enabled(void) const { return m_enabled.load(std::memory_order_relaxed); }
+		bool available(int counter) const { return m_fd[counter] >= 0; }
+		const std::string &error(void) const { return m_error; }
+
+		// Call before starting any threads that should be counted
+		void Enable(void) {
+	#ifdef __linux__
+			static const uint64_t kCacheMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			static const struct { uint32_t type; uint64_t config; } kEvents[kNumCounters] = {
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+				{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | kCacheMiss},
+				{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | kCacheMiss},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+			};
+			for (int c = 0; c < kNumCounters; c++) {
+				perf_event_attr attr;
+				memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = kEvents[c].type;
+				attr.config = kEvents[c].config;
+				attr.inherit = 1;
+				attr.exclude_kernel = 1;	// Allowed up to perf_event_paranoid 2
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				m_fd[c] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+				if(m_fd[c] < 0 && m_error.empty())
+					m_error = Reason(errno);
+			}
+			if(m_fd[kCycles] >= 0)
+				m_enabled.store(true, std::memory_order_relaxed);
+	#else
+			m_error = "perf_event_open is Linux only";
+	#endif
+		}
+
+		// Counts so far, scaled up when the kernel had to multiplex the
+		// counters; 0 for counters that are not available
+		Counts Read(void) const {
+			Counts counts{};
+	#ifdef __linux__
+			for (int c = 0; c < kNumCounters; c++) {
+				struct { uint64_t value, enabled, running; } r;
+				if(m_fd[c] >= 0 && read(m_fd[c], &r, sizeof(r)) == sizeof(r) && r.running > 0)
+					counts.value[c] = r.running < r.enabled ? (uint64_t)((double)r.value * r.enabled / r.running) : r.value;
+			}
+	#endif
+			return counts;
+		}
+
+		// Units the per item columns divide by, e.g. the image's pixels
+		void SetItems(uint64_t items, const std::string &unit) {
+			m_items = items;
+			m_unit = unit;
+		}
+
+		uint64_t items(void) const { return m_items; }
+		const std::string &unit(void) const { return m_unit; }
+
+	private:
+		static std::string Reason(int error) {
+			if(error == EACCES || error == EPERM) {
+				std::string paranoid = "?";
+				std::ifstream f("/proc/sys/kernel/perf_event_paranoid");
+				f >> paranoid;
+				return "not permitted (kernel.perf_event_paranoid is " + paranoid + ", at most 2 is needed)";
+			}
+			if(error == ENOENT || error == EOPNOTSUPP || error == ENODEV)
+				return "not supported by this CPU or VM";
+			return strerror(error);
+		}
+
+		std::atomic<bool> m_enabled{false};
+		int m_fd[kNumCounters] = {-1, -1, -1, -1, -1};
+		std::string m_error;
+		uint64_t m_items = 0;
+		std::string m_unit = "px";
+	};
+
+	// Memory of one zone, all zero unless memory accounting is on. The heap
+	// counters are process wide, so a zone overlapping zones of other
+	// threads is charged for their allocations as well.
+	struct Memory {
+		uint64_t allocs;	// Allocations made while the zone was open
+		uint64_t alloc_bytes;	// and their size
+		int64_t heap_bytes;	// Live heap at the end
+		uint64_t rss_bytes;	// Resident set at the end
+		uint64_t hwm_bytes;	// Highest resident set up to the end
+	};
+
+	// One closed zone, times in ns since the first perf call of the process
+	struct Span {
+		const char *name;
+		uint64_t begin_ns;
+		uint64_t end_ns;
+		uint32_t depth;		// Zones open around it on the same thread
+		uint32_t thread;	// 0 for the first thread to record, and so on
+		uint64_t bytes;		// Memory read plus written, 0 if not given
+		Memory memory;
+		Counts counts;		// Counted while the zone was open, all zero without --counters
+	};
+
+	class Recorder {
+	public:
+		static Recorder &Get(void) {
+			static Recorder recorder;
+			return recorder;
+		}
+
+		static uint64_t Now(void) {
+			static const Clock::time_point epoch = Clock::now();
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+		}
+
+		static uint32_t ThreadIndex(void) {
+			static std::atomic<uint32_t> next(0);
+			thread_local uint32_t index = next++;
+			return index;
+		}
+
+		static uint32_t &Depth(void) {
+			thread_local uint32_t depth = 0;
+			return depth;
+		}
+
+		bool enabled(void) const { return m_enabled.load(std::memory_order_relaxed); }
+
+		void Enable(void) {
+			m_enabled_ns = Now();
+			m_enabled.store(true, std::memory_order_relaxed);
+		}
+
+		uint64_t enabled_ns(void) const { return m_enabled_ns; }
+
+		void SetPeak(double gbps, const std::string &source) {
+			m_peak_gbps = gbps;
+			m_peak_source = source;
+		}
+
+		double peak_gbps(void) const { return m_peak_gbps; }
+		const std::string &peak_source(void) const { return m_peak_source; }
+
+		void Add(const Span &span) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_spans.push_back(span);
+		}
+
+		std::vector<Span> spans(void) const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_spans;
+		}
+
+		// Forget the spans, and start the wall clock of the reports again
+		void Clear(void) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_spans.clear();
+			m_enabled_ns = Now();
+		}
+
+	private:
+		std::atomic<bool> m_enabled{false};
+		uint64_t m_enabled_ns = 0;
+		double m_peak_gbps = 0;
+		std::string m_peak_source;
+		mutable std::mutex m_mutex;
+		std::vector<Span> m_spans;
+	};
+
+	static inline void Enable(void) {
+		Recorder::Get().Enable();
+	}
+
+	static inline bool Enabled(void) {
+		return Recorder::Get().enabled();
+	}
+
+	// Drop what has been recorded, so the next reports start from here
+	static inline void Clear(void) {
+		Recorder::Get().Clear();
+	}
+
+	// Zones count hardware events too, for PrintCounterReport()
+	static inline void EnableCounters(void) {
+		Counters::Get().Enable();
+		Recorder::Get().Enable();
+	}
+
+	// Pixels, or elements, of the input, for the per item counter columns
+	static inline void SetItems(uint64_t items, const std::string &unit) {
+		Counters::Get().SetItems(items, unit);
+	}
+
+	// Zones record memory too, for PrintMemoryReport(). The resident peak
+	// is reset, where the kernel allows it, so that it starts from here.
+	static inline void EnableMemory(void) {
+		FILE *f = fopen("/proc/self/clear_refs", "w");
+		if(f != nullptr) {
+			fputs("5", f);
+			fclose(f);
+		}
+		Heap::Get().Enable();
+		Recorder::Get().Enable();
+	}
+
+	// Memory bandwidth the GB/s columns are a percentage of, 0 for none
+	static inline void SetPeak(double gbps, const std::string &source) {
+		Recorder::Get().SetPeak(gbps, source);
+	}
+
+	// Host memory bandwidth as STREAM measures it: the best of a few
+	// parallel copies of an array well past the last level cache, counting
+	// the bytes read plus the bytes written
+	static inline double MeasureStreamCopy(size_t bytes = size_t(128) << 20, int trials = 5) {
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		size_t count = bytes / sizeof(uint64_t);
+		std::vector<uint64_t> a, b;
+		a.reserve(count);
+		b.reserve(count);
+		auto parallel = [&](auto body) {
+			std::vector<std::thread> workers;
+			for (size_t t = 0; t < threads; t++)
+				workers.emplace_back(body, count * t / threads, count * (t + 1) / threads);
+			for (auto &worker : workers)
+				worker.join();
+		};
+		// First touch from the threads that copy, as STREAM does
+		a.resize(count);
+		b.resize(count);
+		parallel([&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				a[i] = i;
+		});
+		double best = 0;
+		for (int trial = 0; trial < trials; trial++) {
+			auto start = Clock::now();
+			parallel([&](size_t begin, size_t end) {
+				std::copy(a.data() + begin, a.data() + end, b.data() + begin);
+			});
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			best = std::max(best, 2.0 * count * sizeof(uint64_t) / seconds / 1e9);
+		}
+		return best;
+	}
+
+#if PERF_ZONES
+	class ScopedZone {
+	public:
+		explicit ScopedZone(const char *name, uint64_t bytes = 0) {
+			if(!Recorder::Get().enabled())
+				return;
+			m_name = name;
+			m_bytes = bytes;
+			m_depth = Recorder::Depth()++;
+			if(Heap::Get().enabled()) {
+				m_allocs = Heap::Get().allocs();
+				m_alloc_bytes = Heap::Get().bytes();
+			}
+			if(Counters::Get().enabled())
+				m_counts = Counters::Get().Read();
+			m_begin = Recorder::Now();
+		}
+
+		~ScopedZone(void) {
+			End();
+		}
+
+		ScopedZone(const ScopedZone &) = delete;
+		ScopedZone &operator=(const ScopedZone &) = delete;
+
+		void End(void) {
+			if(m_name == nullptr)
+				return;
+			uint64_t end = Recorder::Now();
+			Counts counts{};
+			if(Counters::Get().enabled()) {
+				Counts now = Counters::Get().Read();
+				for (int c = 0; c < kNumCounters; c++)
+					counts.value[c] = now.value[c] > m_counts.value[c] ? now.value[c] - m_counts.value[c] : 0;
+			}
+			Recorder::Depth()--;
+			Memory memory{};
+			const Heap &heap = Heap::Get();
+			if(heap.enabled()) {
+				memory.allocs = heap.allocs() - m_allocs;
+				memory.alloc_bytes = heap.bytes() - m_alloc_bytes;
+				memory.heap_bytes = heap.live();
+				ReadResident(memory.rss_bytes, memory.hwm_bytes);
+			}
+			Recorder::Get().Add(Span{m_name, m_begin, end, m_depth, Recorder::ThreadIndex(), m_bytes, memory, counts});
+			m_name = nullptr;
+		}
+
+	private:
+		const char *m_name = nullptr;
+		uint64_t m_begin = 0;
+		uint64_t m_bytes = 0;
+		uint64_t m_allocs = 0;
+		uint64_t m_alloc_bytes = 0;
+		Counts m_counts{};
+		uint32_t m_depth = 0;
+	};
+#else
+	class ScopedZone {
+	public:
+		explicit ScopedZone(const char *, uint64_t = 0) {}
+		void End(void) {}
+	};
+#endif
+
+	// GB/s and % of peak columns for bytes moved in ns, none without bytes
+	static inline void PrintBandwidth(std::ostream &os, uint64_t bytes, uint64_t ns) {
+		double peak = Recorder::Get().peak_gbps();
+		if(bytes == 0 || ns == 0)
+			return;
+		double gbps = (double)bytes / ns;	// Bytes per ns is GB/s
+		os << std::setw(10) << std::setprecision(2) << gbps;
+		if(peak > 0)
+			os << std::setw(9) << std::setprecision(1) << 100.0 * gbps / peak;
+		os << std::setprecision(3);
+	}
+
+	static inline void PrintPeak(std::ostream &os) {
+		const Recorder &recorder = Recorder::Get();
+		if(recorder.peak_gbps() > 0) {
+			std::ios::fmtflags flags = os.flags();
+			os << "Peak bandwidth " << std::fixed << std::setprecision(1) << recorder.peak_gbps()
+			   << " GB/s (" << recorder.peak_source() << ")\n";
+			os.flags(flags);
+		}
+	}
+
+	// Per stage table of every zone recorded so far: zones of the same name
+	// are summed, listed in the order they first began and indented by
+	// nesting. Percentages are of the time since Enable(); "other" is the
+	// part of it no top level zone of the main thread covers. Zones with a
+	// byte count also get their bandwidth.
+	static inline void PrintReport(std::ostream &os = std::cout) {
+		struct Row {
+			const char *name;
+			uint32_t depth;
+			uint64_t first_ns;
+			size_t calls;
+			uint64_t total_ns;
+			uint64_t bytes;
+		};
+		std::vector<Span> spans = Recorder::Get().spans();
+		uint64_t wall_ns = Recorder::Now() - Recorder::Get().enabled_ns();
+		uint64_t covered_ns = 0;
+		std::vector<Row> rows;
+		for (const Span &span : spans) {
+			if(span.depth == 0 && span.thread == 0)
+				covered_ns += span.end_ns - span.begin_ns;
+			Row *row = nullptr;
+			for (Row &r : rows) {
+				if(std::string(r.name) == span.name) {
+					row = &r;
+					break;
+				}
+			}
+			if(row == nullptr) {
+				rows.push_back(Row{span.name, span.depth, span.begin_ns, 0, 0, 0});
+				row = &rows.back();
+			}
+			row->calls++;
+			row->total_ns += span.end_ns - span.begin_ns;
+			row->bytes += span.bytes;
+			row->first_ns = std::min(row->first_ns, span.begin_ns);
+		}
+		std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.first_ns < b.first_ns; });
+
+		auto pct = [wall_ns](uint64_t ns) { return wall_ns == 0 ? 0.0 : 100.0 * ns / wall_ns; };
+		std::ios::fmtflags flags = os.flags();
+		PrintPeak(os);
+		os << std::left << std::setw(28) << "Stage" << std::right << std::setw(8) << "calls"
+		   << std::setw(13) << "total ms" << std::setw(13) << "mean ms" << std::setw(9) << "%"
+		   << std::setw(10) << "GB/s" << std::setw(9) << "% peak" << "\n";
+		os << std::fixed << std::setprecision(3);
+		for (const Row &r : rows) {
+			os << std::left << std::setw(28) << (std::string(2 * r.depth, ' ') + r.name) << std::right
+			   << std::setw(8) << r.calls << std::setw(13) << r.total_ns / 1e6
+			   << std::setw(13) << r.total_ns / 1e6 / r.calls
+			   << std::setw(9) << std::setprecision(1) << pct(r.total_ns) << std::setprecision(3);
+			PrintBandwidth(os, r.bytes, r.total_ns);
+			os << "\n";
+		}
+		uint64_t other_ns = wall_ns > covered_ns ? wall_ns - covered_ns : 0;
+		os << std::left << std::setw(28) << "other" << std::right << std::setw(8) << ""
+		   << std::setw(13) << other_ns / 1e6 << std::setw(13) << ""
+		   << std::setw(9) << std::setprecision(1) << pct(other_ns) << std::setprecision(3) << "\n";
+		os << std::left << std::setw(28) << "run" << std::right << std::setw(8) << ""
+		   << std::setw(13) << wall_ns / 1e6 << "\n";
+		os.flags(flags);
+	}
+
+	// Per stage memory table, zones grouped as in PrintReport(): the heap
+	// allocations made in the stage, the most heap and resident memory
+	// held at its end, and the resident peak so far. A stage that raises
+	// the peak column is the one that set it.
+	static inline void PrintMemoryReport(std::ostream &os = std::cout) {
+		struct Row {
+			const char *name;
+			uint32_t depth;
+			uint64_t first_ns;
+			uint64_t allocs;
+			uint64_t alloc_bytes;
+			int64_t heap_bytes;
+			uint64_t rss_bytes;
+			uint64_t hwm_bytes;
+		};
+		const Heap &heap = Heap::Get();
+		if(!heap.enabled())
+			return;
+		std::vector<Row> rows;
+		for (const Span &span : Recorder::Get().spans()) {
+			Row *row = nullptr;
+			for (Row &r : rows) {
+				if(std::string(r.name) == span.name) {
+					row = &r;
+					break;
+				}
+			}
+			if(row == nullptr) {
+				rows.push_back(Row{span.name, span.depth, span.begin_ns, 0, 0, INT64_MIN, 0, 0});
+				row = &rows.back();
+			}
+			row->first_ns = std::min(row->first_ns, span.begin_ns);
+			row->allocs += span.memory.allocs;
+			row->alloc_bytes += span.memory.alloc_bytes;
+			row->heap_bytes = std::max(row->heap_bytes, span.memory.heap_bytes);
+			row->rss_bytes = std::max(row->rss_bytes, span.memory.rss_bytes);
+			row->hwm_bytes = std::max(row->hwm_bytes, span.memory.hwm_bytes);
+		}
+		std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.first_ns < b.first_ns; });
+
+		std::ios::fmtflags flags = os.flags();
+		os << std::left << std::setw(28) << "Stage" << std::right;
+		if(heap.hooked())
+			os << std::setw(10) << "allocs" << std::setw(12) << "alloc MB" << std::setw(11) << "heap MB";
+		os << std::setw(11) << "RSS MB" << std::setw(11) << "peak MB" << "\n";
+		os << std::fixed << std::setprecision(1);
+		for (const Row &r : rows) {
+			os << std::left << std::setw(28) << (std::string(2 * r.depth, ' ') + r.name) << std::right;
+			if(heap.hooked())
+				os << std::setw(10) << r.allocs << std::setw(12) << r.alloc_bytes / 1e6 << std::setw(11) << r.heap_bytes / 1e6;
+			os << std::setw(11) << r.rss_bytes / 1e6 << std::setw(11) << r.hwm_bytes / 1e6 << "\n";
+		}
+		uint64_t rss, hwm;
+		ReadResident(rss, hwm);
+		if(heap.hooked())
+			os << "Heap peak " << heap.peak() / 1e6 << " MB in " << heap.allocs() << " allocations, ";
+		os << "resident peak " << hwm / 1e6 << " MB\n";
+		os.flags(flags);
+	}
+
+	// Per stage hardware counter table, zones grouped as in PrintReport():
+	// cycles and instructions in millions, IPC, and LLC load misses, dTLB
+	// load misses and branch misses per item of the input (SetItems()), over
+	// all calls of the stage. "-" marks a counter that is not available.
+	static inline void PrintCounterReport(std::ostream &os = std::cout) {
+		const Counters &counters = Counters::Get();
+		if(!counters.enabled()) {
+			if(!counters.error().empty())
+				os << "Hardware counters unavailable: " << counters.error() << "\n";
+			return;
+		}
+		struct Row {
+			const char *name;
+			uint32_t depth;
+			uint64_t first_ns;
+			Counts counts;
+		};
+		std::vector<Row> rows;
+		for (const Span &span : Recorder::Get().spans()) {
+			Row *row = nullptr;
+			for (Row &r : rows) {
+				if(std::string(r.name) == span.name) {
+					row = &r;
+					break;
+				}
+			}
+			if(row == nullptr) {
+				rows.push_back(Row{span.name, span.depth, span.begin_ns, Counts{}});
+				row = &rows.back();
+			}
+			row->first_ns = std::min(row->first_ns, span.begin_ns);
+			for (int c = 0; c < kNumCounters; c++)
+				row->counts.value[c] += span.counts.value[c];
+		}
+		std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.first_ns < b.first_ns; });
+
+		double items = (double)counters.items();
+		const std::string &unit = counters.unit();
+		auto cell = [&](const Row &r, int c, double scale, int precision) {
+			if(!counters.available(c) || (scale == 0))
+				os << std::setw(11) << "-";
+			else
+				os << std::setw(11) << std::setprecision(precision) << r.counts.value[c] / scale;
+		};
+		std::ios::fmtflags flags = os.flags();
+		os << std::left << std::setw(28) << "Stage" << std::right << std::setw(11) << "Mcycles" << std::setw(11) << "Minstr"
+		   << std::setw(7) << "IPC" << std::setw(11) << ("LLC/" + unit) << std::setw(11) << ("dTLB/" + unit)
+		   << std::setw(11) << ("br/" + unit) << "\n";
+		os << std::fixed;
+		for (const Row &r : rows) {
+			os << std::left << std::setw(28) << (std::string(2 * r.depth, ' ') + r.name) << std::right;
+			cell(r, kCycles, 1e6, 1);
+			cell(r, kInstructions, 1e6, 1);
+			if(counters.available(kInstructions) && r.counts.value[kCycles] > 0)
+				os << std::setw(7) << std::setprecision(2) << (double)r.counts.value[kInstructions] / r.counts.value[kCycles];
+			else
+				os << std::setw(7) << "-";
+			cell(r, kLlcMisses, items, 4);
+			cell(r, kDtlbMisses, items, 4);
+			cell(r, kBranchMisses, items, 4);
+			os << "\n";
+		}
+		os.flags(flags);
+	}
+} // namespace perf
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#define PERF_ZONE(name) perf::ScopedZone PERF_CONCAT(perf_zone_, __LINE__)(name)
+
+#endif // PERF_HPP__
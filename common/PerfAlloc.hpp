@@ -0,0 +1,85 @@
+#ifndef PERF_ALLOC_HPP__
+#define PERF_ALLOC_HPP__
+
+#include <new>
+#include <cstdlib>
+#include <malloc.h>
+
+#include "Perf.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Counting allocator
+// Replaces the global operator new and delete with ones that count into
+// perf::Heap once perf::EnableMemory() is called, and otherwise cost a
+// relaxed load. Replacements are program wide, so include this from exactly
+// one translation unit: the one with main(). Sizes come from
+// malloc_usable_size(), so new and delete agree without a header per block.
+////////////////////////////////////////////////////////////////////////////////
+
+#if PERF_ZONES
+namespace perf {
+	namespace alloc {
+		static inline void *Counted(void *p) {
+			if(p == nullptr)
+				throw std::bad_alloc();
+			if(Heap::Get().enabled())
+				Heap::Get().Allocated(malloc_usable_size(p));
+			return p;
+		}
+
+		// GCC inlines this into delete expressions and then warns that a
+		// pointer from new is passed to free, which is what these
+		// replacements do on purpose
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+		static inline void Release(void *p) {
+			if(p != nullptr && Heap::Get().enabled())
+				Heap::Get().Freed(malloc_usable_size(p));
+			std::free(p);
+		}
+#pragma GCC diagnostic pop
+
+		static inline void *Aligned(std::size_t size, std::align_val_t align) {
+			std::size_t a = static_cast<std::size_t>(align);
+			return aligned_alloc(a, (size + a - 1) / a * a);
+		}
+
+		static const bool hooked = (Heap::Get().SetHooked(), true);
+	} // namespace alloc
+} // namespace perf
+
+void *operator new(std::size_t size) { return perf::alloc::Counted(std::malloc(size ? size : 1)); }
+void *operator new[](std::size_t size) { return perf::alloc::Counted(std::malloc(size ? size : 1)); }
+void *operator new(std::size_t size, std::align_val_t align) { return perf::alloc::Counted(perf::alloc::Aligned(size ? size : 1, align)); }
+void *operator new[](std::size_t size, std::align_val_t align) { return perf::alloc::Counted(perf::alloc::Aligned(size ? size : 1, align)); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return operator new(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return operator new[](size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void *p) noexcept { perf::alloc::Release(p); }
+void operator delete[](void *p) noexcept { perf::alloc::Release(p); }
+void operator delete(void *p, std::size_t) noexcept { perf::alloc::Release(p); }
+void operator delete[](void *p, std::size_t) noexcept { perf::alloc::Release(p); }
+void operator delete(void *p, std::align_val_t) noexcept { perf::alloc::Release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { perf::alloc::Release(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { perf::alloc::Release(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { perf::alloc::Release(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { perf::alloc::Release(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { perf::alloc::Release(p); }
+#endif
+
+#endif // PERF_ALLOC_HPP__
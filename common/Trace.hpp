@@ -0,0 +1,256 @@
+#ifndef TRACE_HPP__
+#define TRACE_HPP__
+
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+#include "Perf.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Chrome trace export
+// --trace=<file> writes every perf zone, and every device command handed to
+// perf::TraceEvent(), in Chrome trace event format for Perfetto or
+// chrome://tracing. Host zones get one track per host thread, device
+// commands one track per name the caller gives, e.g. a queue or a lane's
+// kernel. Device times come from SYCL event profiling, so the queues must be
+// built with perf::QueueProperties(). They are moved onto the host clock by
+// lining each command's submit time up with the host time it was handed in.
+// The same events, with the bytes each kernel reads and writes, give the
+// per kernel bandwidth table of -p.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace perf {
+	class Tracer {
+	public:
+		static Tracer &Get(void) {
+			static Tracer tracer;
+			return tracer;
+		}
+
+		bool enabled(void) const { return m_enabled.load(std::memory_order_relaxed); }
+
+		void Enable(void) {
+			perf::Enable();
+			m_enabled.store(true, std::memory_order_relaxed);
+		}
+
+		// Profiling info is only read once the command is done, in Resolve()
+		void Add(const sycl::event &event, const std::string &track, const std::string &name, uint64_t bytes) {
+			uint64_t host_ns = Recorder::Now();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.push_back(Pending{event, track, name, host_ns, bytes});
+		}
+
+		void Clear(void) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.clear();
+		}
+
+		// A finished device command, on the host clock
+		struct Command {
+			std::string track;
+			std::string name;
+			uint64_t begin_ns;
+			uint64_t end_ns;
+			uint64_t queued_ns;	// From submit to start
+			uint64_t bytes;
+		};
+
+		// Every command added so far; skipped counts those without
+		// profiling info
+		std::vector<Command> Resolve(size_t &skipped) {
+			std::vector<Pending> pending;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				pending = m_pending;
+			}
+			std::vector<Command> commands;
+			skipped = 0;
+			for (const Pending &p : pending) {
+				uint64_t submit, start, end;
+				try {
+					submit = p.event.get_profiling_info<sycl::info::event_profiling::command_submit>();
+					start = p.event.get_profiling_info<sycl::info::event_profiling::command_start>();
+					end = p.event.get_profiling_info<sycl::info::event_profiling::command_end>();
+				} catch (std::exception const &) {
+					skipped++;
+					continue;
+				}
+				int64_t offset = (int64_t)p.host_ns - (int64_t)submit;
+				uint64_t begin = (uint64_t)std::max<int64_t>(0, (int64_t)start + offset);
+				commands.push_back(Command{p.track, p.name, begin, begin + (end - start), start - submit, p.bytes});
+			}
+			return commands;
+		}
+
+		bool Write(const std::string &path) {
+			std::ofstream f(path);
+			if(!f)
+				return false;
+
+			std::vector<Span> spans = Recorder::Get().spans();
+
+			// Host tracks are pid 1, one tid per thread; device tracks are
+			// pid 2, one tid per track name in order of first use
+			f << std::fixed << std::setprecision(3);
+			f << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+			f << "  {\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, \"args\": {\"name\": \"host\"}},\n";
+			f << "  {\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 2, \"args\": {\"name\": \"device\"}}";
+			uint32_t threads = 0;
+			for (const Span &span : spans)
+				threads = std::max(threads, span.thread + 1);
+			for (uint32_t t = 0; t < threads; t++) {
+				f << ",\n  {\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << t
+				  << ", \"args\": {\"name\": " << Quote(t == 0 ? std::string("main") : "thread " + std::to_string(t)) << "}}";
+			}
+			for (const Span &span : spans) {
+				f << ",\n  {\"ph\": \"X\", \"cat\": \"host\", \"name\": " << Quote(span.name)
+				  << ", \"pid\": 1, \"tid\": " << span.thread
+				  << ", \"ts\": " << span.begin_ns / 1e3 << ", \"dur\": " << (span.end_ns - span.begin_ns) / 1e3 << "}";
+			}
+
+			size_t skipped;
+			std::vector<std::string> tracks;
+			for (const Command &c : Resolve(skipped)) {
+				size_t tid = std::find(tracks.begin(), tracks.end(), c.track) - tracks.begin();
+				if(tid == tracks.size()) {
+					tracks.push_back(c.track);
+					f << ",\n  {\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 2, \"tid\": " << tid
+					  << ", \"args\": {\"name\": " << Quote(c.track) << "}}";
+				}
+				f << ",\n  {\"ph\": \"X\", \"cat\": \"device\", \"name\": " << Quote(c.name)
+				  << ", \"pid\": 2, \"tid\": " << tid
+				  << ", \"ts\": " << c.begin_ns / 1e3 << ", \"dur\": " << (c.end_ns - c.begin_ns) / 1e3
+				  << ", \"args\": {\"queued_us\": " << c.queued_ns / 1e3 << ", \"bytes\": " << c.bytes << "}}";
+			}
+			f << "\n]}\n";
+			if(skipped > 0)
+				std::cerr << skipped << " device commands had no profiling info and are not in the trace" << std::endl;
+			return (bool)f;
+		}
+
+	private:
+		struct Pending {
+			sycl::event event;
+			std::string track;
+			std::string name;
+			uint64_t host_ns;	// Host time just after the submit
+			uint64_t bytes;
+		};
+
+		static std::string Quote(const std::string &s) {
+			std::string out = "\"";
+			for (char ch : s) {
+				if(ch == '"' || ch == '\\')
+					out += '\\';
+				out += ch;
+			}
+			return out + "\"";
+		}
+
+		std::atomic<bool> m_enabled{false};
+		std::mutex m_mutex;
+		std::vector<Pending> m_pending;
+	};
+
+	static inline void EnableTrace(void) {
+		Tracer::Get().Enable();
+	}
+
+	static inline bool TraceEnabled(void) {
+		return Tracer::Get().enabled();
+	}
+
+	// Queue properties: profiling only when tracing, it is not free on
+	// every device
+	static inline sycl::property_list QueueProperties(void) {
+		if(TraceEnabled())
+			return sycl::property_list{sycl::property::queue::enable_profiling()};
+		return sycl::property_list{};
+	}
+
+	// Put the command behind event on the device track named track. Call it
+	// straight after the submit, before any wait. bytes is what the kernel
+	// reads plus what it writes.
+	static inline void TraceEvent(const sycl::event &event, const std::string &track, const std::string &name,
+				      uint64_t bytes = 0) {
+		if(TraceEnabled())
+			Tracer::Get().Add(event, track, name, bytes);
+	}
+
+	// Device time and bandwidth of every traced kernel, one row per track
+	// and kernel. "all" spans the first start to the last end, so with
+	// kernels running side by side it is their combined bandwidth.
+	static inline void PrintDeviceReport(std::ostream &os = std::cout) {
+		struct Row {
+			std::string track;
+			std::string name;
+			size_t runs;
+			uint64_t busy_ns;
+			uint64_t bytes;
+		};
+		size_t skipped;
+		std::vector<Tracer::Command> commands = Tracer::Get().Resolve(skipped);
+		if(commands.empty()) {
+			if(skipped > 0)
+				os << "No device profiling info, the device kernel table is unavailable\n";
+			return;
+		}
+		std::vector<Row> rows;
+		uint64_t first = UINT64_MAX, last = 0, bytes = 0;
+		for (const Tracer::Command &c : commands) {
+			auto row = std::find_if(rows.begin(), rows.end(),
+						[&c](const Row &r) { return r.track == c.track && r.name == c.name; });
+			if(row == rows.end()) {
+				rows.push_back(Row{c.track, c.name, 0, 0, 0});
+				row = rows.end() - 1;
+			}
+			row->runs++;
+			row->busy_ns += c.end_ns - c.begin_ns;
+			row->bytes += c.bytes;
+			first = std::min(first, c.begin_ns);
+			last = std::max(last, c.end_ns);
+			bytes += c.bytes;
+		}
+
+		std::ios::fmtflags flags = os.flags();
+		os << std::left << std::setw(28) << "Device kernel" << std::right << std::setw(8) << "runs"
+		   << std::setw(13) << "device ms" << std::setw(13) << "MB" << std::setw(9) << ""
+		   << std::setw(10) << "GB/s" << std::setw(9) << "% peak" << "\n";
+		os << std::fixed << std::setprecision(3);
+		for (const Row &r : rows) {
+			// "lane 0 producer" rather than "lane 0 producer producer"
+			std::string label = r.track.find(r.name) != std::string::npos ? r.track : r.track + " " + r.name;
+			os << std::left << std::setw(28) << label << std::right << std::setw(8) << r.runs
+			   << std::setw(13) << r.busy_ns / 1e6 << std::setw(13) << r.bytes / 1e6 << std::setw(9) << "";
+			PrintBandwidth(os, r.bytes, r.busy_ns);
+			os << "\n";
+		}
+		os << std::left << std::setw(28) << "all" << std::right << std::setw(8) << commands.size()
+		   << std::setw(13) << (last - first) / 1e6 << std::setw(13) << bytes / 1e6 << std::setw(9) << "";
+		PrintBandwidth(os, bytes, last - first);
+		os << "\n";
+		os.flags(flags);
+	}
+
+	static inline bool WriteTrace(const std::string &path) {
+		return Tracer::Get().Write(path);
+	}
+
+	// Drop the host zones and device commands recorded so far, for a
+	// process that reports one piece of work after another
+	static inline void ClearTrace(void) {
+		Tracer::Get().Clear();
+		Clear();
+	}
+} // namespace perf
+
+#endif // TRACE_HPP__
@@ -0,0 +1,120 @@
+#ifndef VERIFY_HPP__
+#define VERIFY_HPP__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// --verify: checks a command's output against a host reference without
+// writing or reading any files. The reference is computed a band of rows at
+// a time into a small scratch buffer, so the expected image never exists in
+// full. Each band of the reference and of the output is hashed with XXH64,
+// and only a band whose hashes differ is compared element by element to
+// find the first wrong row and column.
+namespace verify
+{
+	constexpr size_t kBandRows = 16;
+
+	static inline uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+	static inline uint64_t Read64(const unsigned char *p) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static inline uint32_t Read32(const unsigned char *p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	// XXH64 of len bytes. Its four accumulators are independent, so the main
+	// loop runs four multiplies at once instead of one long chain.
+	static inline uint64_t Hash(const void *data, size_t len, uint64_t seed = 0) {
+		const uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL, P3 = 0x165667B19E3779F9ULL;
+		const uint64_t P4 = 0x85EBCA77C2B2AE63ULL, P5 = 0x27D4EB2F165667C5ULL;
+		auto round = [=](uint64_t acc, uint64_t in) { return Rotl(acc + in * P2, 31) * P1; };
+		auto merge = [=](uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; };
+
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		const unsigned char *end = p + len;
+		uint64_t h;
+		if(len >= 32) {
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+			for (; p + 32 <= end; p += 32) {
+				v1 = round(v1, Read64(p));
+				v2 = round(v2, Read64(p + 8));
+				v3 = round(v3, Read64(p + 16));
+				v4 = round(v4, Read64(p + 24));
+			}
+			h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		} else {
+			h = seed + P5;
+		}
+		h += len;
+		for (; p + 8 <= end; p += 8)
+			h = Rotl(h ^ round(0, Read64(p)), 27) * P1 + P4;
+		if(p + 4 <= end) {
+			h = Rotl(h ^ (Read32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; p++)
+			h = Rotl(h ^ (*p * P5), 11) * P1;
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	template <typename T>
+	struct Result {
+		bool ok = true;
+		size_t bands = 0;     // Bands compared
+		uint64_t digest = 0;  // Hash of the output's band hashes, same output same digest
+		size_t row = 0;       // First difference, when !ok
+		size_t col = 0;
+		T expected{};
+		T actual{};
+	};
+
+	// Check the rows x width row-major output against reference(first_row,
+	// rows, out), which writes rows rows of the expected output, starting at
+	// first_row, to out. Elements are compared bit for bit.
+	template <typename T, typename Reference>
+	Result<T> Check(const T *output, size_t width, size_t rows, Reference reference, size_t band_rows = kBandRows) {
+		Result<T> result;
+		std::vector<T> expected(band_rows * width);
+		std::vector<uint64_t> hashes;
+		for (size_t first = 0; first < rows; first += band_rows) {
+			size_t band = std::min(band_rows, rows - first);
+			size_t count = band * width;
+			const T *actual = output + first * width;
+			reference(first, band, expected.data());
+			uint64_t want = Hash(expected.data(), count * sizeof(T));
+			uint64_t got = Hash(actual, count * sizeof(T));
+			hashes.push_back(got);
+			result.bands++;
+			if(want != got && result.ok) {
+				for (size_t i = 0; i < count; i++) {
+					if(memcmp(&expected[i], &actual[i], sizeof(T)) != 0) {
+						result.ok = false;
+						result.row = first + i / width;
+						result.col = i % width;
+						result.expected = expected[i];
+						result.actual = actual[i];
+						break;
+					}
+				}
+			}
+		}
+		result.digest = Hash(hashes.data(), hashes.size() * sizeof(uint64_t));
+		return result;
+	}
+} // namespace verify
+#endif // VERIFY_HPP__
@@ -0,0 +1,349 @@
+// datagen.cpp
+//
+// Deterministic synthetic inputs for the accelerators: CSV and .npy
+// matrices, PNG and raw images, of any size. Every value is a function of
+// the seed and its position only, so the same arguments give the same file
+// whatever the thread count. Rows are generated in parallel a block at a
+// time and written as each block completes, so memory stays flat.
+//
+// use (from build/, files go to ../in/):
+//   ./datagen -o=data_in_10k_10k.csv -rows=10000 -cols=10000 --seed=7
+//   ./datagen -o=noise.png -rows=2160 -cols=3840 --depth=8 --channels=3
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <png.h>
+
+#include "io.hpp"
+
+// Max filename string length
+constexpr int kMaxStringLen = 256;
+
+// Bytes of values generated per block
+constexpr size_t kGenBlockBytes = 64 << 20;
+
+namespace gen
+{
+	constexpr uint64_t kGolden = 0x9E3779B97F4A7C15ull;
+
+	// Output n of the splitmix64 sequence seeded with seed. Any output can be
+	// computed directly, which lets every thread start anywhere in the file.
+	inline uint64_t SplitMix64(uint64_t seed, uint64_t n)
+	{
+		uint64_t z = seed + (n + 1) * kGolden;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in [min, max]
+	inline int UniformInt(uint64_t bits, int64_t min, int64_t max)
+	{
+		uint64_t span = (uint64_t)(max - min) + 1;
+		return (int)(min + (int64_t)(((unsigned __int128)bits * span) >> 64));
+	}
+
+	// Uniform in [min, max), 24 random bits
+	inline float UniformFloat(uint64_t bits, double min, double max)
+	{
+		return (float)(min + (double)(bits >> 40) * 0x1.0p-24 * (max - min));
+	}
+
+	// Run fn(first, last) over [0, count) split evenly between the threads
+	template <typename Fn>
+	void ParallelFor(size_t count, Fn fn)
+	{
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		threads = std::min(threads, std::max<size_t>(1, count));
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; t++)
+			workers.emplace_back([&, t]() { fn(count * t / threads, count * (t + 1) / threads); });
+		for (auto &worker : workers)
+			worker.join();
+	}
+
+	// Generate rows x cols values of T a block of rows at a time, handing
+	// each block to sink(data, first_row, block_rows) in row order
+	template <typename T, typename Value, typename Sink>
+	bool Generate(size_t rows, size_t cols, Value value, Sink sink)
+	{
+		size_t block_rows = std::max<size_t>(1, kGenBlockBytes / std::max<size_t>(1, cols * sizeof(T)));
+		Matrix<T> block(std::min(block_rows, rows), cols);
+		for (size_t first = 0; first < rows; first += block_rows)
+		{
+			size_t count = std::min(block_rows, rows - first);
+			T *data = block.data();
+			ParallelFor(count * cols, [&](size_t begin, size_t end)
+			{
+				uint64_t base = (uint64_t)first * cols;
+				for (size_t i = begin; i < end; i++)
+					data[i] = value(base + i);
+			});
+			if (!sink(data, first, count))
+				return false;
+		}
+		return true;
+	}
+} // namespace gen
+
+struct Options
+{
+	std::string outfilename;
+	size_t rows = 0;
+	size_t cols = 0;
+	uint64_t seed = 1;
+	int64_t min = 0;
+	int64_t max = 1000;
+	std::string type = "int";
+	int depth = 16;
+	int channels = 4;
+};
+
+bool FindGetArgString(std::string &arg, const char *str, char *str_value, size_t maxchars)
+{
+	if (arg.compare(0, strlen(str), str) != 0)
+		return false;
+	strncpy(str_value, &arg.c_str()[strlen(str)], maxchars - 1);
+	str_value[maxchars - 1] = 0;
+	return true;
+}
+
+template <typename T>
+bool FindGetArgNumber(std::string &arg, const char *str, T *val)
+{
+	char buffer[kMaxStringLen] = {0};
+	if (!FindGetArgString(arg, str, buffer, kMaxStringLen))
+		return false;
+	long long value = strtoll(buffer, nullptr, 0);
+	// A negative size would wrap to a huge one, unsigned options take none
+	if (std::is_unsigned<T>::value && value < 0)
+		throw std::invalid_argument(std::string(str, strlen(str) - 1) + " must not be negative");
+	*val = (T)value;
+	return true;
+}
+
+void Help(void)
+{
+	std::cout << "datagen -o=<output file> -rows=<n> -cols=<n> [options]\n";
+	std::cout << "  -h,--help                                : this help text\n";
+	std::cout << "  -o=<output file>                         : written to ../in/, format from the extension:\n";
+	std::cout << "                                             .csv, .npy (matrices), .png, .raw (images)\n";
+	std::cout << "  -rows=<n> -cols=<n>                      : matrix shape, or image height and width\n";
+	std::cout << "  --seed=<n>                               : same seed, same file (default 1)\n";
+	std::cout << "  --min=<n> --max=<n>                      : matrix value range (default 0 to 1000)\n";
+	std::cout << "  --type=<int|float>                       : matrix element type (default int)\n";
+	std::cout << "  --depth=<8|16>                           : image bits per channel (default 16)\n";
+	std::cout << "  --channels=<1-4>                         : gray, gray+alpha, RGB, RGBA (default 4)\n";
+	std::cout << "  .raw images are rows x cols x channels samples, row-major, interleaved,\n";
+	std::cout << "  16-bit samples little-endian, no header\n";
+}
+
+bool HasExtension(const std::string &name, const char *ext)
+{
+	size_t len = strlen(ext);
+	return name.size() >= len && name.compare(name.size() - len, len, ext) == 0;
+}
+
+// CSV or .npy matrix of T
+template <typename T, typename Value>
+bool WriteMatrix(int fd, const Options &opt, Value value)
+{
+	bool npy = HasExtension(opt.outfilename, ".npy");
+	if (npy)
+	{
+		std::string header = npy::MakeHeader<T>(opt.rows, opt.cols);
+		if (!WriteAll(fd, {iovec{header.data(), header.size()}}))
+			return false;
+	}
+	return gen::Generate<T>(opt.rows, opt.cols, value,
+		[&](const T *data, size_t, size_t rows)
+		{
+			if (npy)
+				return WriteAll(fd, {iovec{const_cast<T *>(data), rows * opt.cols * sizeof(T)}});
+			return csv::Format(fd, data, rows, opt.cols);
+		});
+}
+
+// Image of opt.depth bit samples, opt.channels per pixel
+template <typename T>
+bool WriteImage(int fd, const Options &opt)
+{
+	size_t samples = opt.cols * opt.channels;
+	auto value = [&](uint64_t n) { return (T)(gen::SplitMix64(opt.seed, n) >> (64 - 8 * sizeof(T))); };
+
+	if (HasExtension(opt.outfilename, ".raw"))
+	{
+		return gen::Generate<T>(opt.rows, samples, value,
+			[&](const T *data, size_t, size_t rows)
+			{
+				return WriteAll(fd, {iovec{const_cast<T *>(data), rows * samples * sizeof(T)}});
+			});
+	}
+
+	// The samples are random, so skip filtering and compress as little as
+	// possible; zlib is the only serial step left
+	FILE *fp = fdopen(dup(fd), "wb");
+	if (fp == nullptr)
+		return false;
+	png_struct *png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_info *info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png)))
+	{
+		png_destroy_write_struct(&png, &info);
+		fclose(fp);
+		return false;
+	}
+	const int color_types[] = {PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA};
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, opt.cols, opt.rows, opt.depth, color_types[opt.channels - 1],
+		     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+	png_set_compression_level(png, 1);
+	png_write_info(png, info);
+	if (sizeof(T) == 2)
+		png_set_swap(png);	// PNG stores 16-bit samples big-endian
+
+	bool ok = gen::Generate<T>(opt.rows, samples, value,
+		[&](const T *data, size_t, size_t rows)
+		{
+			for (size_t row = 0; row < rows; row++)
+				png_write_row(png, (png_const_bytep)(data + row * samples));
+			return true;
+		});
+	png_write_end(png, info);
+	png_destroy_write_struct(&png, &info);
+	return fclose(fp) == 0 && ok;
+}
+
+int main(int argc, char *argv[])
+{
+	Options opt;
+	char out_file_str_buffer[kMaxStringLen] = {0};
+	char type_str_buffer[kMaxStringLen] = "int";
+	bool help = argc < 2;
+
+	try
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string sarg(argv[i]);
+			if (sarg == "-h" || sarg == "--help")
+				help = true;
+			FindGetArgString(sarg, "-o=", out_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "-out=", out_file_str_buffer, kMaxStringLen);
+			FindGetArgString(sarg, "--output-file=", out_file_str_buffer, kMaxStringLen);
+			FindGetArgNumber(sarg, "-rows=", &opt.rows);
+			FindGetArgNumber(sarg, "-cols=", &opt.cols);
+			FindGetArgNumber(sarg, "--seed=", &opt.seed);
+			FindGetArgNumber(sarg, "--min=", &opt.min);
+			FindGetArgNumber(sarg, "--max=", &opt.max);
+			FindGetArgString(sarg, "--type=", type_str_buffer, kMaxStringLen);
+			FindGetArgNumber(sarg, "--depth=", &opt.depth);
+			FindGetArgNumber(sarg, "--channels=", &opt.channels);
+		}
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (help)
+	{
+		Help();
+		return 1;
+	}
+
+	opt.outfilename = std::string(out_file_str_buffer);
+	opt.type = std::string(type_str_buffer);
+	bool matrix = HasExtension(opt.outfilename, ".csv") || HasExtension(opt.outfilename, ".npy");
+	bool image = HasExtension(opt.outfilename, ".png") || HasExtension(opt.outfilename, ".raw");
+
+	if (!matrix && !image)
+	{
+		std::cerr << "Output '" << opt.outfilename << "' must end in .csv, .npy, .png or .raw" << std::endl;
+		return 1;
+	}
+	if (opt.rows == 0 || opt.cols == 0)
+	{
+		std::cerr << "Set the size with -rows=<n> -cols=<n>" << std::endl;
+		return 1;
+	}
+	if (matrix && opt.type != "int" && opt.type != "float")
+	{
+		std::cerr << "Unknown element type '" << opt.type << "', use --type=int or --type=float" << std::endl;
+		return 1;
+	}
+	if (matrix && (opt.min > opt.max || opt.min < INT32_MIN || opt.max > INT32_MAX))
+	{
+		std::cerr << "Bad range " << opt.min << " to " << opt.max << std::endl;
+		return 1;
+	}
+	if (image && (opt.depth != 8 && opt.depth != 16))
+	{
+		std::cerr << "Image depth must be 8 or 16 bits" << std::endl;
+		return 1;
+	}
+	if (image && (opt.channels < 1 || opt.channels > 4))
+	{
+		std::cerr << "Images have 1 to 4 channels" << std::endl;
+		return 1;
+	}
+
+	std::string outfilepath = "../in/" + opt.outfilename;
+	std::cout << "Writing " << opt.rows << "x" << opt.cols;
+	if (matrix)
+		std::cout << " " << opt.type << " matrix";
+	else
+		std::cout << " " << opt.depth << "-bit " << opt.channels << "-channel image";
+	std::cout << ", seed " << opt.seed << ", to '" << outfilepath << "'" << std::endl;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	int fd = open(outfilepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		std::cerr << "Failed to open '" << outfilepath << "'" << std::endl;
+		return 1;
+	}
+
+	bool ok;
+	if (matrix && opt.type == "float")
+		ok = WriteMatrix<float>(fd, opt,
+			[&](uint64_t n) { return gen::UniformFloat(gen::SplitMix64(opt.seed, n), opt.min, opt.max); });
+	else if (matrix)
+		ok = WriteMatrix<int>(fd, opt,
+			[&](uint64_t n) { return gen::UniformInt(gen::SplitMix64(opt.seed, n), opt.min, opt.max); });
+	else if (opt.depth == 8)
+		ok = WriteImage<uint8_t>(fd, opt);
+	else
+		ok = WriteImage<uint16_t>(fd, opt);
+
+	off_t bytes = lseek(fd, 0, SEEK_END);
+	if (close(fd) != 0)
+		ok = false;
+	if (!ok)
+	{
+		std::cerr << "Failed to write '" << outfilepath << "'" << std::endl;
+		return 1;
+	}
+
+	auto end_time = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double, std::milli> process_time(end_time - start_time);
+	std::cout << "Wrote " << bytes << " bytes in " << process_time.count() << " milliseconds ("
+		  << bytes / 1e3 / process_time.count() << " MB/s)\n";
+	return 0;
+}
@@ -0,0 +1,605 @@
+#ifndef IO_HPP__
+#define IO_HPP__
+
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <charconv>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#include "Matrix.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// File I/O
+// Files ending in .npy are NumPy arrays, everything else is CSV
+template <typename T, typename Dest>
+bool ReadInputData(std::string infilename, size_t &rows, size_t &cols, Dest dest);
+template <typename T, typename Allocator>
+bool ReadInputData(std::string infilename, Matrix<T, Allocator> &indata);
+template <typename T>
+bool WriteOutputData(std::string outfilename, const T *outdata, size_t rows, size_t cols);
+template <typename T, typename Allocator>
+bool WriteOutputData(std::string outfilename, const Matrix<T, Allocator> &outdata);
+////////////////////////////////////////////////////////////////////////////////
+
+// Read-only memory map of a whole file, unmapped on destruction
+class MappedFile {
+public:
+	MappedFile(const std::string &path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			return;
+		struct stat st;
+		if(fstat(fd, &st) == 0) {
+			m_size = st.st_size;
+			m_ok = true;
+			if(m_size > 0) {
+				void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if(ptr == MAP_FAILED) {
+					m_ok = false;
+				} else {
+					m_data = static_cast<const char *>(ptr);
+					madvise(ptr, m_size, MADV_SEQUENTIAL);
+				}
+			}
+		}
+		close(fd);
+	}
+
+	~MappedFile(void) {
+		if(m_data != nullptr)
+			munmap(const_cast<char *>(m_data), m_size);
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool ok(void) const { return m_ok; }
+	const char *data(void) const { return m_data; }
+	size_t size(void) const { return m_size; }
+
+private:
+	const char *m_data = nullptr;
+	size_t m_size = 0;
+	bool m_ok = false;
+};
+
+// writev all of iov, resuming after short writes
+inline bool WriteAll(int fd, std::vector<struct iovec> iov) {
+	size_t first = 0;
+	while(first < iov.size()) {
+		int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+		ssize_t written = writev(fd, iov.data() + first, count);
+		if(written < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		size_t left = written;
+		while(first < iov.size() && left >= iov[first].iov_len) {
+			left -= iov[first].iov_len;
+			first++;
+		}
+		if(left > 0) {
+			iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+			iov[first].iov_len -= left;
+		}
+	}
+	return true;
+}
+
+// Parallel CSV parsing. The text is cut into newline-aligned chunks, one per
+// thread. A first pass counts the lines of every chunk with memchr (SIMD in
+// glibc) to find each chunk's first row; the second pass parses each chunk
+// with std::from_chars straight into its rows of the output matrix. As with
+// the getline and std::stoi reader before it, a value may start with '+'
+// and blank lines at the end are not rows.
+namespace csv {
+	constexpr size_t kMinChunkBytes = 1 << 20;	// Below this, threads cost more than they save
+
+	struct Chunk {
+		const char *begin;
+		const char *end;
+		size_t first_row;
+		size_t rows;
+		size_t bad_row;		// First ragged or unparsable row, or SIZE_MAX
+		std::string error;
+	};
+
+	inline size_t CountLines(const char *begin, const char *end) {
+		size_t lines = 0;
+		const char *p = begin;
+		while(p < end) {
+			const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+			lines++;
+			if(nl == nullptr)
+				break;
+			p = nl + 1;
+		}
+		return lines;
+	}
+
+	// Fields in the first line
+	inline size_t CountColumns(const char *begin, const char *end) {
+		const char *nl = static_cast<const char *>(memchr(begin, '\n', end - begin));
+		const char *line_end = nl == nullptr ? end : nl;
+		return std::count(begin, line_end, ',') + 1;
+	}
+
+	inline std::vector<Chunk> Split(const char *data, size_t size, size_t threads) {
+		size_t count = std::max<size_t>(1, std::min(threads, size / kMinChunkBytes));
+		std::vector<Chunk> chunks;
+		const char *end = data + size;
+		const char *p = data;
+		for(size_t i = 0; i < count && p < end; i++) {
+			const char *stop = i + 1 == count ? end : data + (size * (i + 1)) / count;
+			if(stop < p)
+				stop = p;
+			const char *nl = stop < end ? static_cast<const char *>(memchr(stop, '\n', end - stop)) : nullptr;
+			stop = nl == nullptr ? end : nl + 1;
+			chunks.push_back(Chunk{p, stop, 0, 0, SIZE_MAX, ""});
+			p = stop;
+		}
+		return chunks;
+	}
+
+	inline bool IsBlank(char ch) {
+		return ch == ' ' || ch == '\t' || ch == '\r';
+	}
+
+	// Parse every line of a chunk into out, cols values per row
+	template <typename T>
+	void ParseChunk(Chunk &chunk, size_t cols, T *out) {
+		const char *p = chunk.begin;
+		const char *end = chunk.end;
+		for(size_t row = 0; row < chunk.rows; row++) {
+			T *dst = out + (chunk.first_row + row) * cols;
+			size_t col = 0;
+			for(;;) {
+				while(p < end && IsBlank(*p))
+					p++;
+				if(col == cols) {
+					chunk.bad_row = chunk.first_row + row;
+					chunk.error = "more than " + std::to_string(cols) + " values";
+					return;
+				}
+				if(end - p > 1 && *p == '+' && p[1] != '-')
+					p++;	// from_chars takes no '+'
+				auto result = std::from_chars(p, end, dst[col]);
+				if(result.ec != std::errc()) {
+					chunk.bad_row = chunk.first_row + row;
+					chunk.error = "bad value in column " + std::to_string(col);
+					return;
+				}
+				col++;
+				p = result.ptr;
+				while(p < end && IsBlank(*p))
+					p++;
+				if(p < end && *p == ',') {
+					p++;
+					continue;
+				}
+				if(p == end || *p == '\n')
+					break;
+				chunk.bad_row = chunk.first_row + row;
+				chunk.error = "unexpected '" + std::string(1, *p) + "' in column " + std::to_string(col - 1);
+				return;
+			}
+			if(col != cols) {
+				chunk.bad_row = chunk.first_row + row;
+				chunk.error = std::to_string(col) + " values, expected " + std::to_string(cols);
+				return;
+			}
+			if(p < end)
+				p++;	// '\n'
+		}
+	}
+
+	// Find the shape of the CSV text, then parse it with dest(rows, cols)
+	// returning where the rows * cols values go. Returns false and prints
+	// the first bad row on ragged or malformed input; first_row numbers the
+	// rows of text that is only part of a file.
+	template <typename T, typename Dest>
+	bool Parse(const char *data, size_t size, const std::string &name, size_t &rows, size_t &cols, Dest dest,
+		   size_t first_row = 0) {
+		rows = 0;
+		cols = 0;
+		while(size > 0 && (IsBlank(data[size - 1]) || data[size - 1] == '\n'))
+			size--;
+		if(size == 0) {
+			dest(0, 0);
+			return true;
+		}
+
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<Chunk> chunks = Split(data, size, threads);
+
+		std::vector<std::thread> workers;
+		for(auto &chunk : chunks)
+			workers.emplace_back([&chunk]() { chunk.rows = CountLines(chunk.begin, chunk.end); });
+		for(auto &worker : workers)
+			worker.join();
+		workers.clear();
+
+		for(auto &chunk : chunks) {
+			chunk.first_row = rows;
+			rows += chunk.rows;
+		}
+		cols = CountColumns(data, data + size);
+
+		T *out = dest(rows, cols);
+		if(out == nullptr)
+			return false;
+
+		for(auto &chunk : chunks)
+			workers.emplace_back([&chunk, cols, out]() { ParseChunk(chunk, cols, out); });
+		for(auto &worker : workers)
+			worker.join();
+
+		for(auto &chunk : chunks) {
+			if(chunk.bad_row != SIZE_MAX) {
+				std::cerr << "'" << name << "' row " << first_row + chunk.bad_row << ": " << chunk.error << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Parallel CSV formatting. Rows are formatted in rounds: every thread
+	// renders one block of rows into its own buffer with std::to_chars, then
+	// the round's buffers go out in row order with a single writev.
+	constexpr size_t kBlockBytes = 4 << 20;	// Formatted text per thread per round
+
+	// Longest text of one value, sign and separator included. Floating
+	// point takes up to max_digits10 digits, a point and an exponent.
+	template <typename T>
+	constexpr size_t MaxFieldChars(void) {
+		if constexpr(std::is_floating_point<T>::value)
+			return std::numeric_limits<T>::max_digits10 + 8;
+		else
+			return std::numeric_limits<T>::digits10 + 3;
+	}
+
+	template <typename T>
+	size_t FormatRows(const T *data, size_t first_row, size_t last_row, size_t cols, char *out) {
+		char *p = out;
+		for(size_t row = first_row; row < last_row; row++) {
+			const T *src = data + row * cols;
+			for(size_t col = 0; col < cols; col++) {
+				p = std::to_chars(p, p + MaxFieldChars<T>(), src[col]).ptr;
+				*p++ = col + 1 == cols ? '\n' : ',';
+			}
+		}
+		return p - out;
+	}
+
+	template <typename T>
+	bool Format(int fd, const T *data, size_t rows, size_t cols) {
+		if(rows == 0 || cols == 0)
+			return true;
+
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		size_t row_bytes = cols * MaxFieldChars<T>();
+		size_t block_rows = std::max<size_t>(1, kBlockBytes / row_bytes);
+		threads = std::min(threads, (rows + block_rows - 1) / block_rows);
+
+		std::vector<std::vector<char>> buffers(threads, std::vector<char>(block_rows * row_bytes));
+		std::vector<size_t> lengths(threads);
+
+		for(size_t round_row = 0; round_row < rows; round_row += threads * block_rows) {
+			std::vector<std::thread> workers;
+			for(size_t t = 0; t < threads; t++) {
+				size_t first = std::min(rows, round_row + t * block_rows);
+				size_t last = std::min(rows, first + block_rows);
+				workers.emplace_back([&, t, first, last]() {
+					lengths[t] = FormatRows(data, first, last, cols, buffers[t].data());
+				});
+			}
+			for(auto &worker : workers)
+				worker.join();
+
+			std::vector<struct iovec> iov;
+			for(size_t t = 0; t < threads; t++) {
+				if(lengths[t] > 0)
+					iov.push_back(iovec{buffers[t].data(), lengths[t]});
+			}
+			if(!WriteAll(fd, iov))
+				return false;
+		}
+		return true;
+	}
+} // namespace csv
+
+// NumPy .npy arrays: a magic string, a version, a Python dict literal header
+// padded to 64 bytes, then the raw data. Only little-endian C-order arrays of
+// one or two dimensions are read; a 1-D array is one value per row.
+namespace npy {
+	enum class DType { Int32, Int64, UInt16, Float32 };
+
+	struct Header {
+		DType dtype;
+		size_t rows;
+		size_t cols;
+		size_t data_offset;
+	};
+
+	constexpr char kMagic[] = "\x93NUMPY";
+	constexpr size_t kMagicLen = 6;
+	constexpr size_t kAlign = 64;
+
+	inline size_t DTypeSize(DType dtype) {
+		switch(dtype) {
+			case DType::Int64: return 8;
+			case DType::UInt16: return 2;
+			default: return 4;
+		}
+	}
+
+	template <typename T> constexpr const char *Descr(void);
+	template <> constexpr const char *Descr<int32_t>(void) { return "<i4"; }
+	template <> constexpr const char *Descr<int64_t>(void) { return "<i8"; }
+	template <> constexpr const char *Descr<uint16_t>(void) { return "<u2"; }
+	template <> constexpr const char *Descr<float>(void) { return "<f4"; }
+
+	template <typename T> constexpr bool Is(DType dtype) { return false; }
+	template <> constexpr bool Is<int32_t>(DType dtype) { return dtype == DType::Int32; }
+	template <> constexpr bool Is<int64_t>(DType dtype) { return dtype == DType::Int64; }
+	template <> constexpr bool Is<uint16_t>(DType dtype) { return dtype == DType::UInt16; }
+	template <> constexpr bool Is<float>(DType dtype) { return dtype == DType::Float32; }
+
+	// Text following 'key': in the header dict
+	inline bool FindValue(const std::string &dict, const char *key, std::string &value) {
+		size_t at = dict.find(std::string("'") + key + "'");
+		if(at == std::string::npos)
+			return false;
+		at = dict.find(':', at);
+		if(at == std::string::npos)
+			return false;
+		value = dict.substr(at + 1);
+		value.erase(0, value.find_first_not_of(' '));
+		return true;
+	}
+
+	inline bool ParseHeader(const char *data, size_t size, Header &header, std::string &error) {
+		if(size < kMagicLen + 4 || memcmp(data, kMagic, kMagicLen) != 0) {
+			error = "not a .npy file";
+			return false;
+		}
+		uint8_t major = data[6];
+		size_t dict_len, dict_at;
+		if(major == 1) {
+			dict_len = (uint8_t)data[8] | (uint8_t)data[9] << 8;
+			dict_at = 10;
+		} else if((major == 2 || major == 3) && size >= 12) {
+			dict_len = (uint32_t)(uint8_t)data[8] | (uint32_t)(uint8_t)data[9] << 8 |
+				   (uint32_t)(uint8_t)data[10] << 16 | (uint32_t)(uint8_t)data[11] << 24;
+			dict_at = 12;
+		} else {
+			error = "unsupported .npy version " + std::to_string(major);
+			return false;
+		}
+		if(dict_at + dict_len > size) {
+			error = "truncated header";
+			return false;
+		}
+		std::string dict(data + dict_at, dict_len);
+
+		std::string descr, fortran, shape;
+		if(!FindValue(dict, "descr", descr) || !FindValue(dict, "fortran_order", fortran) ||
+		   !FindValue(dict, "shape", shape)) {
+			error = "incomplete header";
+			return false;
+		}
+		descr = descr.substr(1, descr.find('\'', 1) - 1);
+		if(descr == "<i4" || descr == "=i4")
+			header.dtype = DType::Int32;
+		else if(descr == "<i8" || descr == "=i8")
+			header.dtype = DType::Int64;
+		else if(descr == "<u2" || descr == "=u2")
+			header.dtype = DType::UInt16;
+		else if(descr == "<f4" || descr == "=f4")
+			header.dtype = DType::Float32;
+		else {
+			error = "unsupported dtype '" + descr + "', expected int32, int64, uint16 or float32";
+			return false;
+		}
+		if(fortran.compare(0, 5, "False") != 0) {
+			error = "Fortran-order arrays are not supported";
+			return false;
+		}
+
+		// (rows,) or (rows, cols). Without the closing ')' the end of the
+		// shape would be npos past its start.
+		size_t close = shape.find(')');
+		if(shape[0] != '(' || close == std::string::npos) {
+			error = "bad header";
+			return false;
+		}
+		std::vector<size_t> dims;
+		const char *p = shape.c_str() + 1;
+		const char *end = shape.c_str() + close;
+		while(p < end) {
+			while(p < end && (*p == ' ' || *p == ','))
+				p++;
+			if(p == end)
+				break;
+			size_t dim;
+			auto result = std::from_chars(p, end, dim);
+			if(result.ec != std::errc()) {
+				error = "bad shape";
+				return false;
+			}
+			dims.push_back(dim);
+			p = result.ptr;
+			if(p < end && *p == 'L')	// Python 2 long suffix
+				p++;
+		}
+		if(dims.size() == 1) {
+			header.rows = dims[0];
+			header.cols = 1;
+		} else if(dims.size() == 2) {
+			header.rows = dims[0];
+			header.cols = dims[1];
+		} else {
+			error = std::to_string(dims.size()) + "-D arrays are not supported";
+			return false;
+		}
+
+		// Divided rather than multiplied out, so a huge shape cannot wrap
+		header.data_offset = dict_at + dict_len;
+		size_t elements = (size - std::min(size, header.data_offset)) / DTypeSize(header.dtype);
+		if(header.data_offset > size ||
+		   (header.rows != 0 && header.cols > elements / header.rows)) {
+			error = "file is shorter than its shape";
+			return false;
+		}
+		return true;
+	}
+
+	template <typename From, typename T>
+	void Convert(const char *src, T *dst, size_t count) {
+		const From *from = reinterpret_cast<const From *>(src);
+		for(size_t i = 0; i < count; i++)
+			dst[i] = static_cast<T>(from[i]);
+	}
+
+	// Copy the array out of the mapping into dst. A matching dtype is one
+	// memcpy, anything else is converted element by element.
+	template <typename T>
+	void Load(const Header &header, const char *data, T *dst) {
+		const char *src = data + header.data_offset;
+		size_t count = header.rows * header.cols;
+		if(Is<T>(header.dtype)) {
+			memcpy(dst, src, count * sizeof(T));
+			return;
+		}
+		switch(header.dtype) {
+			case DType::Int32: Convert<int32_t>(src, dst, count); break;
+			case DType::Int64: Convert<int64_t>(src, dst, count); break;
+			case DType::UInt16: Convert<uint16_t>(src, dst, count); break;
+			case DType::Float32: Convert<float>(src, dst, count); break;
+		}
+	}
+
+	// Version 1.0 header for a rows x cols array of T
+	template <typename T>
+	std::string MakeHeader(size_t rows, size_t cols) {
+		std::string dict = std::string("{'descr': '") + Descr<T>() + "', 'fortran_order': False, 'shape': (" +
+				   std::to_string(rows) + ", " + std::to_string(cols) + "), }";
+		size_t total = kMagicLen + 4 + dict.size() + 1;
+		dict.append((kAlign - total % kAlign) % kAlign, ' ');
+		dict.push_back('\n');
+
+		std::string header(kMagic, kMagicLen);
+		header.push_back('\x01');
+		header.push_back('\x00');
+		header.push_back(static_cast<char>(dict.size() & 0xFF));
+		header.push_back(static_cast<char>(dict.size() >> 8));
+		return header + dict;
+	}
+} // namespace npy
+
+inline bool IsNpyFile(const std::string &filename) {
+	return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".npy") == 0;
+}
+
+// Read a matrix into the rows * cols values returned by dest(rows, cols),
+// which is where the kernel wants its input. .npy data is copied straight
+// out of the mapped file.
+template <typename T, typename Dest>
+bool ReadInputData(std::string infilename, size_t &rows, size_t &cols, Dest dest) {
+	std::string infilepath = "../in/" + infilename;
+
+	std::cout << "Reading data from '" << infilepath << "'" << std::endl;
+
+	MappedFile file(infilepath);
+	if(!file.ok()) {
+		std::cerr << "Failed to open '" << infilepath << "'" << std::endl;
+		return false;
+	}
+
+	if(IsNpyFile(infilename)) {
+		npy::Header header;
+		std::string error;
+		if(!npy::ParseHeader(file.data(), file.size(), header, error)) {
+			std::cerr << "'" << infilepath << "': " << error << std::endl;
+			return false;
+		}
+		rows = header.rows;
+		cols = header.cols;
+		T *out = dest(rows, cols);
+		if(out == nullptr)
+			return false;
+		npy::Load(header, file.data(), out);
+		return true;
+	}
+
+	return csv::Parse<T>(file.data(), file.size(), infilepath, rows, cols, dest);
+}
+
+// Read a matrix into indata, sized to the file
+template <typename T, typename Allocator>
+bool ReadInputData(std::string infilename, Matrix<T, Allocator> &indata) {
+	size_t rows, cols;
+	return ReadInputData<T>(infilename, rows, cols,
+		[&indata](size_t rows, size_t cols) -> T * {
+			try {
+				indata.resize(rows, cols);
+			} catch(const std::bad_alloc &) {
+				std::cerr << "Failed to allocate a " << rows << "x" << cols << " matrix" << std::endl;
+				return nullptr;
+			}
+			return indata.data();
+		});
+}
+
+template <typename T>
+bool WriteOutputData(std::string outfilename, const T *outdata, size_t rows, size_t cols) {
+	std::string outfilepath = "../out/" + outfilename;
+
+	std::cout << "Writing data to '" << outfilepath << "'" << std::endl;
+
+	int fd = open(outfilepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		std::cerr << "Failed to open '" << outfilepath << "'" << std::endl;
+		return false;
+	}
+
+	bool ok;
+	if(IsNpyFile(outfilename)) {
+		std::string header = npy::MakeHeader<T>(rows, cols);
+		std::vector<struct iovec> iov = {
+			iovec{header.data(), header.size()},
+			iovec{const_cast<T *>(outdata), rows * cols * sizeof(T)}};
+		ok = WriteAll(fd, iov);
+	} else {
+		ok = csv::Format(fd, outdata, rows, cols);
+	}
+	if(close(fd) != 0)
+		ok = false;
+	if(!ok)
+		std::cerr << "Failed to write '" << outfilepath << "'" << std::endl;
+	return ok;
+}
+
+template <typename T, typename Allocator>
+bool WriteOutputData(std::string outfilename, const Matrix<T, Allocator> &outdata) {
+	return WriteOutputData(outfilename, outdata.data(), outdata.rows(), outdata.cols());
+}
+
+#endif // IO_HPP__